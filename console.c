@@ -1,17 +1,23 @@
 /* Implementation of simple command-line interface */
 
 #include <ctype.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/select.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "console.h"
+#include "perfcount.h"
+#include "random.h"
 #include "report.h"
 #include "web.h"
 
@@ -20,6 +26,26 @@ int simulation = 0;
 int show_entropy = 0;
 static cmd_element_t *cmd_list = NULL;
 static param_element_t *param_list = NULL;
+
+/* The lists give help and completion their alphabetical order; lookups by
+ * name go through open-addressing hash tables instead, so dispatching a
+ * command costs one hash of its name rather than a strcmp per command.
+ */
+typedef struct {
+    const char *name; /* NULL for an empty slot */
+    unsigned int hash;
+    void *element;
+} name_slot_t;
+
+typedef struct {
+    name_slot_t *slots;
+    size_t cap; /* power of two */
+    size_t cnt;
+} name_table_t;
+
+#define NAME_TABLE_MIN_CAP 64
+
+static name_table_t cmd_table, param_table;
 static bool block_flag = false;
 static bool prompt_flag = true;
 
@@ -31,20 +57,55 @@ static double first_time, last_time;
 
 /* Implement buffered I/O using variant of RIO package from CS:APP
  * Must create stack of buffers to handle I/O with nested source commands.
+ *
+ * Regular files are mapped into memory whole, and other inputs are read into
+ * the internal buffer. Either way, lines are handed out in place rather than
+ * copied out a byte at a time.
  */
 
 #define RIO_BUFSIZE 8192
 
 typedef struct __rio {
     int fd;                /* File descriptor */
-    int count;             /* Unread bytes in internal buffer */
-    char *bufptr;          /* Next unread byte in internal buffer */
-    char buf[RIO_BUFSIZE]; /* Internal buffer */
+    size_t count;          /* Unread bytes at bufptr */
+    char *bufptr;          /* Next unread byte */
+    char *map;             /* Mapping of the whole file, or NULL */
+    size_t map_len;        /* Length of the mapping */
+    struct __trace *trace; /* Records of a compiled trace, or NULL */
+    char buf[RIO_BUFSIZE]; /* Internal buffer, unless mapped */
     struct __rio *prev;    /* Next element in stack */
 } rio_t;
 
+/* Compiled traces
+ *
+ * "compile" turns a trace into a file which replays without tokenizing or
+ * allocating: a header, the offsets of the distinct words and lines of the
+ * trace, the records, then the strings themselves, null-terminated. A record
+ * is the number of words of a line, the line as echoed, then its words, all
+ * as 32-bit indices into the string offsets. Commands are named rather than
+ * numbered in the file, and looked up once when it is loaded.
+ */
+#define TRACE_MAGIC "QTRACE1"
+
+typedef struct {
+    char magic[8];
+    uint32_t n_strings;
+    uint32_t n_words; /* 32-bit words in the records */
+    uint32_t max_argc;
+} trace_header_t;
+
+typedef struct __trace {
+    const uint32_t *words;
+    uint32_t n_words;
+    uint32_t pos; /* Next record */
+    uint32_t n_strings;
+    char **strs;
+    cmd_element_t **cmds; /* Command named by each string, or NULL */
+    uint32_t max_argc;
+    char **argv; /* Arguments of the record being replayed */
+} trace_t;
+
 static rio_t *buf_stack;
-static char linebuf[RIO_BUFSIZE];
 
 /* Maximum file descriptor */
 static int fd_max = 0;
@@ -69,9 +130,88 @@ static void init_in();
 
 static bool push_file(char *fname);
 static void pop_file();
+static bool load_trace(rio_t *r);
+static void free_trace(trace_t *t);
+static void replay_next();
+static bool do_compile(int argc, char *argv[]);
+static bool run_line(cmd_element_t *next_cmd, int argc, char *argv[]);
+static bool discard_block();
+static void free_vars();
+static bool do_let(int argc, char *argv[]);
+static bool do_repeat(int argc, char *argv[]);
+static bool do_choose(int argc, char *argv[]);
+static bool do_bench(int argc, char *argv[]);
 
 static bool interpret_cmda(int argc, char *argv[]);
 
+/* FNV-1a */
+static unsigned int name_hash(const char *name)
+{
+    unsigned int h = 2166136261u;
+    while (*name) {
+        h ^= (unsigned char) *name++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static name_slot_t *name_probe(name_slot_t *slots,
+                               size_t cap,
+                               const char *name,
+                               unsigned int hash)
+{
+    size_t i = hash & (cap - 1);
+    while (slots[i].name &&
+           (slots[i].hash != hash || strcmp(slots[i].name, name)))
+        i = (i + 1) & (cap - 1);
+    return &slots[i];
+}
+
+static void *name_find(const name_table_t *t, const char *name)
+{
+    if (!t->cnt)
+        return NULL;
+    return name_probe(t->slots, t->cap, name, name_hash(name))->element;
+}
+
+/* Map @name to @element, replacing an element added earlier under the same
+ * name as the lists do
+ */
+static void name_add(name_table_t *t, const char *name, void *element)
+{
+    /* Keep the load factor below 1/2 so probe sequences stay short */
+    if (2 * (t->cnt + 1) > t->cap) {
+        size_t cap = t->cap ? 2 * t->cap : NAME_TABLE_MIN_CAP;
+        name_slot_t *slots =
+            calloc_or_fail(cap, sizeof(name_slot_t), "name_add");
+        for (size_t i = 0; i < t->cap; i++) {
+            if (t->slots[i].name)
+                *name_probe(slots, cap, t->slots[i].name, t->slots[i].hash) =
+                    t->slots[i];
+        }
+        if (t->slots)
+            free_array(t->slots, t->cap, sizeof(name_slot_t));
+        t->slots = slots;
+        t->cap = cap;
+    }
+
+    unsigned int hash = name_hash(name);
+    name_slot_t *slot = name_probe(t->slots, t->cap, name, hash);
+    if (!slot->name)
+        t->cnt++;
+    slot->name = name;
+    slot->hash = hash;
+    slot->element = element;
+}
+
+static void name_clear(name_table_t *t)
+{
+    if (t->slots)
+        free_array(t->slots, t->cap, sizeof(name_slot_t));
+    t->slots = NULL;
+    t->cap = t->cnt = 0;
+}
+
 /* Add a new command */
 void add_cmd(char *name, cmd_func_t operation, char *summary, char *param)
 {
@@ -89,6 +229,7 @@ void add_cmd(char *name, cmd_func_t operation, char *summary, char *param)
     cmd->param = param;
     cmd->next = next_cmd;
     *last_loc = cmd;
+    name_add(&cmd_table, name, cmd);
 }
 
 /* Add a new parameter */
@@ -109,26 +250,55 @@ void add_param(char *name, int *valp, char *summary, setter_func_t setter)
     param->setter = setter;
     param->next = next_param;
     *last_loc = param;
+    name_add(&param_table, name, param);
 }
 
-/* Parse a string into a command line */
-static char **parse_args(char *line, int *argcp)
+/* Buffers parse_args() splits command lines into. They are only replaced
+ * when a line longer than any before shows up, so that interpreting a line
+ * allocates nothing.
+ */
+static char *line_buf = NULL;
+static size_t line_cap = 0;
+static char **argv_buf = NULL;
+static size_t argv_cap = 0;
+
+static void free_args()
 {
-    /* Must first determine how many arguments there are.
-     * Replace all white space with null characters
-     */
-    size_t len = strlen(line);
+    if (line_buf)
+        free_block(line_buf, line_cap);
+    if (argv_buf)
+        free_array(argv_buf, argv_cap, sizeof(char *));
+    line_buf = NULL;
+    argv_buf = NULL;
+    line_cap = argv_cap = 0;
+}
 
-    /* First copy into buffer with each substring null-terminated */
-    char *buf = malloc_or_fail(len + 1, "parse_args");
-    buf[len] = '\0';
+/* Parse the first @len characters of a string into a command line.
+ * The words point into a buffer of the interpreter, and stay valid until the
+ * next call.
+ */
+static char **parse_args(const char *line, size_t len, int *argcp)
+{
+    if (len + 1 > line_cap) {
+        /* Words are separated by white space, so there are at most
+         * (len + 1) / 2 of them, plus the terminating NULL
+         */
+        free_args();
+        line_cap = len + 1;
+        line_buf = malloc_or_fail(line_cap, "parse_args");
+        argv_cap = (len + 1) / 2 + 1;
+        argv_buf = malloc_or_fail(argv_cap * sizeof(char *), "parse_args");
+    }
 
-    char *src = line;
-    char *dst = buf;
+    /* Copy into buffer with each substring null-terminated, and record where
+     * every substring starts
+     */
+    const char *src = line, *end = line + len;
+    char *dst = line_buf;
     bool skipping = true;
     int c;
     int argc = 0;
-    while ((c = *src++) != '\0') {
+    while (src < end && (c = *src++) != '\0') {
         if (isspace(c)) {
             if (!skipping) {
                 /* Hit end of word */
@@ -138,26 +308,18 @@ static char **parse_args(char *line, int *argcp)
         } else {
             if (skipping) {
                 /* Hit start of new word */
-                argc++;
+                argv_buf[argc++] = dst;
                 skipping = false;
             }
             *dst++ = c;
         }
     }
     /* Let the last substring is null-terminated */
-    *dst++ = '\0';
+    *dst = '\0';
+    argv_buf[argc] = NULL;
 
-    /* Now assemble into array of strings */
-    char **argv = calloc_or_fail(argc, sizeof(char *), "parse_args");
-    src = buf;
-    for (int i = 0; i < argc; i++) {
-        argv[i] = strsave_or_fail(src, "parse_args");
-        src += strlen(argv[i]) + 1;
-    }
-
-    free_block(buf, len + 1);
     *argcp = argc;
-    return argv;
+    return argv_buf;
 }
 
 /* Handles forced console termination for record_error and do_quit */
@@ -177,14 +339,26 @@ static bool force_quit(int argc, char *argv[])
         p = p->next;
         free_block(ele, sizeof(param_element_t));
     }
+    cmd_list = NULL;
+    param_list = NULL;
+    name_clear(&cmd_table);
+    name_clear(&param_table);
 
-    while (buf_stack)
-        pop_file();
-
+    /* Helpers run first: @argv may point into the file being replayed */
     for (int i = 0; i < quit_helper_cnt; i++) {
         ok = ok && quit_helpers[i](argc, argv);
     }
 
+    while (buf_stack)
+        pop_file();
+    free_args();
+    if (discard_block()) {
+        report(1, "Block left without closing '}'");
+        ok = false;
+    }
+    free_vars();
+    perfcount_close();
+
     quit_flag = true;
     return ok;
 }
@@ -200,16 +374,10 @@ static void record_error()
     }
 }
 
-/* Execute a command that has already been split into arguments */
-static bool interpret_cmda(int argc, char *argv[])
+/* Execute command @next_cmd, NULL if argv[0] names none */
+static bool run_cmd(cmd_element_t *next_cmd, int argc, char *argv[])
 {
-    if (argc == 0)
-        return true;
-    /* Try to find matching command */
-    cmd_element_t *next_cmd = cmd_list;
     bool ok = true;
-    while (next_cmd && strcmp(argv[0], next_cmd->name) != 0)
-        next_cmd = next_cmd->next;
     if (next_cmd) {
         ok = next_cmd->operation(argc, argv);
         if (!ok)
@@ -223,20 +391,30 @@ static bool interpret_cmda(int argc, char *argv[])
     return ok;
 }
 
-/* Execute a command from a command line */
-static bool interpret_cmd(char *cmdline)
+/* Execute a command that has already been split into arguments */
+static bool interpret_cmda(int argc, char *argv[])
+{
+    if (argc == 0)
+        return true;
+    /* Try to find matching command */
+    return run_line(name_find(&cmd_table, argv[0]), argc, argv);
+}
+
+/* Execute a command from the first @len characters of a command line */
+static bool interpret_line(const char *cmdline, size_t len)
 {
     if (quit_flag)
         return false;
 
     int argc;
-    char **argv = parse_args(cmdline, &argc);
-    bool ok = interpret_cmda(argc, argv);
-    for (int i = 0; i < argc; i++)
-        free_string(argv[i]);
-    free_array(argv, argc, sizeof(char *));
+    char **argv = parse_args(cmdline, len, &argc);
+    return interpret_cmda(argc, argv);
+}
 
-    return ok;
+/* Execute a command from a command line */
+static bool interpret_cmd(char *cmdline)
+{
+    return interpret_line(cmdline, strlen(cmdline));
 }
 
 /* Set function to be executed as part of program exit */
@@ -330,17 +508,14 @@ static bool do_option(int argc, char *argv[])
             report(1, "Cannot parse '%s' as integer", argv[i]);
             return false;
         }
-        /* Find parameter in list */
-        param_element_t *plist = param_list;
-        while (!found && plist) {
-            if (strcmp(plist->name, name) == 0) {
-                int oldval = *plist->valp;
-                *plist->valp = value;
-                if (plist->setter)
-                    plist->setter(oldval);
-                found = true;
-            } else
-                plist = plist->next;
+        /* Find parameter */
+        param_element_t *param = name_find(&param_table, name);
+        if (param) {
+            int oldval = *param->valp;
+            *param->valp = value;
+            if (param->setter)
+                param->setter(oldval);
+            found = true;
         }
         /* Didn't find parameter */
         if (!found) {
@@ -402,6 +577,194 @@ static bool do_time(int argc, char *argv[])
     return ok;
 }
 
+/* Functions "bench -r" keeps the state commands act on with */
+static snapshot_func_t snapshot_save = NULL;
+static snapshot_func_t snapshot_restore = NULL;
+static snapshot_func_t snapshot_discard = NULL;
+
+void set_snapshot_helpers(snapshot_func_t save,
+                          snapshot_func_t restore,
+                          snapshot_func_t discard)
+{
+    snapshot_save = save;
+    snapshot_restore = restore;
+    snapshot_discard = discard;
+}
+
+/* Report hardware counters of each command line, see perfcount.h */
+static int perf_counters = 0;
+static bool counting = false; /* Inside a counted region */
+
+static void perf_changed(int oldval)
+{
+    if (!perf_counters) {
+        perfcount_close();
+    } else if (!perfcount_open()) {
+        report(1, "Hardware counters are not available: %s", strerror(errno));
+        perf_counters = 0;
+    }
+}
+
+/* Start counting a region, unless counters are off or an enclosing region
+ * is counted already. Return whether perf_end() should end it.
+ */
+static bool perf_begin()
+{
+    if (!perf_counters || counting)
+        return false;
+    counting = true;
+    perfcount_start();
+    return true;
+}
+
+static void perf_end(const char *what)
+{
+    perfcount_t c;
+    perfcount_stop(&c);
+    counting = false;
+
+    /* Nothing to show if the region turned counters off or quit */
+    if (!perf_counters || quit_flag)
+        return;
+    char buf[256];
+    report(1, "%s: %s", what, perfcount_format(buf, sizeof(buf), &c));
+}
+
+static int64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int cmp_ns(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *) a, y = *(const int64_t *) b;
+    return (x > y) - (x < y);
+}
+
+/* Nearest-rank percentile @p of @n sorted samples */
+static double percentile_us(const int64_t *t, int n, int p)
+{
+    int rank = (int) (((int64_t) p * n + 99) / 100);
+    return t[rank > 0 ? rank - 1 : 0] / 1000.0;
+}
+
+static bool do_bench(int argc, char *argv[])
+{
+    int reps = 100, warmup = 10;
+    bool restore = false;
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-'; i++) {
+        if (!strcmp(argv[i], "-r")) {
+            restore = true;
+            continue;
+        }
+        int *valp = !strcmp(argv[i], "-n")   ? &reps
+                    : !strcmp(argv[i], "-w") ? &warmup
+                                             : NULL;
+        if (!valp) {
+            report(1, "Unknown option '%s'", argv[i]);
+            return false;
+        }
+        if (i + 1 >= argc || !get_int(argv[i + 1], valp) || *valp < 0) {
+            report(1, "%s needs a count", argv[i]);
+            return false;
+        }
+        i++;
+    }
+    if (i >= argc) {
+        report(1, "Usage: bench [-n reps] [-w warmup] [-r] cmd arg ...");
+        return false;
+    }
+    if (reps < 1) {
+        report(1, "Need at least one repetition");
+        return false;
+    }
+
+    cmd_element_t *cmd = name_find(&cmd_table, argv[i]);
+    if (!cmd) {
+        report(1, "Unknown command '%s'", argv[i]);
+        return false;
+    }
+    if (cmd->operation == do_repeat || cmd->operation == do_choose ||
+        cmd->operation == do_bench || cmd->operation == do_quit) {
+        report(1, "Cannot bench '%s'", argv[i]);
+        return false;
+    }
+    if (restore && !snapshot_save) {
+        report(1, "No state to restore in this program");
+        return false;
+    }
+    if (restore && !snapshot_save())
+        return false;
+
+    int64_t *t = malloc_or_fail(reps * sizeof(int64_t), "do_bench");
+
+    /* Hitting the error limit quits, which frees the line argv points into */
+    const char *name = cmd->name;
+
+    /* What commands print would be timed too, only keep errors */
+    int saved_verblevel = verblevel;
+    if (verblevel > 1)
+        verblevel = 1;
+
+    /* Counters are summed over the timed runs, around the clock readings */
+    bool counted = perf_counters && !counting;
+    perfcount_t sum = {0};
+
+    bool ok = true;
+    int done = 0;
+    for (int k = 0; k < warmup + reps && ok && !quit_flag; k++) {
+        if (counted && k >= warmup)
+            perfcount_start();
+        int64_t start = now_ns();
+        ok = run_cmd(cmd, argc - i, argv + i);
+        int64_t elapsed = now_ns() - start;
+        if (k >= warmup) {
+            t[done++] = elapsed;
+            if (counted) {
+                perfcount_t c;
+                perfcount_stop(&c);
+                perfcount_add(&sum, &c);
+            }
+        }
+        if (restore && !quit_flag)
+            ok = snapshot_restore() && ok;
+    }
+    verblevel = saved_verblevel;
+    /* The error which made the command quit is recorded already */
+    if (quit_flag) {
+        free_array(t, reps, sizeof(int64_t));
+        return true;
+    }
+    if (restore)
+        snapshot_discard();
+
+    if (done) {
+        int64_t total = 0;
+        for (int k = 0; k < done; k++)
+            total += t[k];
+        qsort(t, done, sizeof(int64_t), cmp_ns);
+        report(1,
+               "%d runs of '%s': min %.3f us, median %.3f us, p90 %.3f us, "
+               "p99 %.3f us, max %.3f us, %.0f ops/sec",
+               done, name, t[0] / 1000.0, percentile_us(t, done, 50),
+               percentile_us(t, done, 90), percentile_us(t, done, 99),
+               t[done - 1] / 1000.0, total ? done * 1e9 / total : 0.0);
+        if (counted && perf_counters) {
+            char buf[256];
+            report(1, "Per run: %s",
+                   perfcount_format(buf, sizeof(buf), &sum));
+        }
+    }
+    if (!ok)
+        report(1, "Benchmark stopped after %d of %d runs", done, reps);
+
+    free_array(t, reps, sizeof(int64_t));
+    return ok;
+}
+
 static bool use_linenoise = true;
 static int web_fd;
 
@@ -430,6 +793,8 @@ void init_cmd()
 {
     cmd_list = NULL;
     param_list = NULL;
+    name_clear(&cmd_table);
+    name_clear(&param_table);
     err_cnt = 0;
     quit_flag = false;
 
@@ -441,13 +806,28 @@ void init_cmd()
     ADD_COMMAND(source, "Read commands from source file", "file");
     ADD_COMMAND(log, "Copy output to file", "file");
     ADD_COMMAND(time, "Time command execution", "cmd arg ...");
+    ADD_COMMAND(bench,
+                "Time repeated runs of command, restoring queues after each "
+                "with -r",
+                "[-n reps] [-w warmup] [-r] cmd arg ...");
     ADD_COMMAND(web, "Read commands from builtin web server", "[port]");
+    ADD_COMMAND(compile, "Compile trace file into a faster replayable form",
+                "file out");
+    ADD_COMMAND(let, "Set or show integer variable, $name gives its value",
+                "name [= expr]");
+    ADD_COMMAND(repeat, "Run block until '}' expr times", "expr {");
+    ADD_COMMAND(choose,
+                "Run one line of block until '}', at random by leading weight",
+                "{");
     add_cmd("#", do_comment_cmd, "Display comment", "...");
     add_param("simulation", &simulation, "Start/Stop simulation mode", NULL);
     add_param("verbose", &verblevel, "Verbosity level", NULL);
     add_param("error", &err_limit, "Number of errors until exit", NULL);
     add_param("echo", &echo, "Do/don't echo commands", NULL);
     add_param("entropy", &show_entropy, "Show/Hide Shannon entropy", NULL);
+    add_param("perf", &perf_counters,
+              "Show hardware counters of each command (perf_event_open)",
+              perf_changed);
 
     init_in();
     init_time(&last_time);
@@ -472,9 +852,35 @@ static bool push_file(char *fname)
     rnew->fd = fd;
     rnew->count = 0;
     rnew->bufptr = rnew->buf;
+    rnew->map = NULL;
+    rnew->map_len = 0;
+    rnew->trace = NULL;
     rnew->prev = buf_stack;
     buf_stack = rnew;
 
+    /* Fall back on read() for pipes, terminals and empty files. The mapping
+     * is private and writable, as replayed commands get their arguments in
+     * place.
+     */
+    struct stat st;
+    if (fname && !fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                         fd, 0);
+        if (map != MAP_FAILED) {
+            madvise(map, st.st_size, MADV_SEQUENTIAL);
+            rnew->map = rnew->bufptr = map;
+            rnew->map_len = rnew->count = st.st_size;
+        }
+    }
+
+    if (rnew->map && rnew->map_len >= sizeof(trace_header_t) &&
+        !memcmp(rnew->map, TRACE_MAGIC, sizeof(TRACE_MAGIC)) &&
+        !load_trace(rnew)) {
+        report(1, "Corrupted compiled trace '%s'", fname);
+        pop_file();
+        return false;
+    }
+
     return true;
 }
 
@@ -484,6 +890,10 @@ static void pop_file()
     if (buf_stack) {
         rio_t *rsave = buf_stack;
         buf_stack = rsave->prev;
+        if (rsave->trace)
+            free_trace(rsave->trace);
+        if (rsave->map)
+            munmap(rsave->map, rsave->map_len);
         close(rsave->fd);
         free_block(rsave, sizeof(rio_t));
     }
@@ -495,60 +905,891 @@ static void init_in()
     buf_stack = NULL;
 }
 
+/* Hand out the next @len bytes of input as a line, skipping the newline
+ * following them if @eol
+ */
+static char *take_line(size_t len, bool eol, size_t *lenp)
+{
+    char *line = buf_stack->bufptr;
+    buf_stack->bufptr += len + eol;
+    buf_stack->count -= len + eol;
+    *lenp = len;
+
+    if (echo) {
+        report_noreturn(1, prompt);
+        report_noreturn(1, "%.*s\n", (int) len, line);
+    }
+    return line;
+}
+
 /* Read command from input file.
+ * Return the line, without its newline and not null-terminated, and store its
+ * length in @lenp. The line stays valid until the next call.
  * When hit EOF, close that file and return NULL
  */
-static char *readline()
+static char *readline(size_t *lenp)
 {
-    char c;
-    char *lptr = linebuf;
-
     if (!buf_stack)
         return NULL;
 
-    for (int cnt = 0; cnt < RIO_BUFSIZE - 2; cnt++) {
-        if (buf_stack->count <= 0) {
-            /* Need to read from input file */
-            buf_stack->count = read(buf_stack->fd, buf_stack->buf, RIO_BUFSIZE);
-            buf_stack->bufptr = buf_stack->buf;
-            if (buf_stack->count <= 0) {
-                /* Encountered EOF */
-                pop_file();
-                if (cnt > 0) {
-                    /* Last line of file did not terminate with newline. */
-                    /*  Terminate line & return it */
-                    *lptr++ = '\n';
-                    *lptr++ = '\0';
-                    if (echo) {
-                        report_noreturn(1, prompt);
-                        report_noreturn(1, linebuf);
-                    }
-                    return linebuf;
-                }
-                return NULL;
+    while (true) {
+        char *nl = memchr(buf_stack->bufptr, '\n', buf_stack->count);
+        if (nl)
+            return take_line(nl - buf_stack->bufptr, true, lenp);
+
+        if (buf_stack->map) {
+            /* Last line of file did not terminate with newline */
+            if (buf_stack->count > 0)
+                return take_line(buf_stack->count, false, lenp);
+            pop_file();
+            return NULL;
+        }
+
+        if (buf_stack->count >= RIO_BUFSIZE - 2) {
+            /* Hit buffer limit.  Artificially terminate line */
+            return take_line(RIO_BUFSIZE - 2, false, lenp);
+        }
+
+        /* Keep the partial line at the start of the buffer, and read from
+         * input file after it
+         */
+        memmove(buf_stack->buf, buf_stack->bufptr, buf_stack->count);
+        buf_stack->bufptr = buf_stack->buf;
+        ssize_t n = read(buf_stack->fd, buf_stack->buf + buf_stack->count,
+                         RIO_BUFSIZE - buf_stack->count);
+        if (n <= 0) {
+            /* Encountered EOF */
+            if (buf_stack->count > 0) {
+                /* Last line of file did not terminate with newline */
+                return take_line(buf_stack->count, false, lenp);
             }
+            pop_file();
+            return NULL;
         }
+        buf_stack->count += n;
+    }
+}
 
-        /* Have text in buffer */
-        c = *buf_stack->bufptr++;
-        *lptr++ = c;
-        buf_stack->count--;
-        if (c == '\n')
-            break;
+/* Check a mapped compiled trace and prepare it for replay */
+static bool load_trace(rio_t *r)
+{
+    const trace_header_t *h = (const trace_header_t *) r->map;
+    size_t len = r->map_len;
+    size_t words_at = sizeof(*h) + (size_t) h->n_strings * sizeof(uint32_t);
+    if (words_at > len ||
+        (len - words_at) / sizeof(uint32_t) < (size_t) h->n_words)
+        return false;
+
+    /* Strings end at the end of the file at the latest */
+    if (r->map[len - 1] != '\0')
+        return false;
+
+    const uint32_t *offsets = (const uint32_t *) (r->map + sizeof(*h));
+    const uint32_t *words = (const uint32_t *) (r->map + words_at);
+    for (uint32_t i = 0; i < h->n_strings; i++) {
+        if (offsets[i] >= len)
+            return false;
+    }
+    for (uint32_t pos = 0; pos < h->n_words; pos += 2 + words[pos]) {
+        uint32_t argc = words[pos];
+        if (argc > h->max_argc || h->n_words - pos < 2 + (size_t) argc)
+            return false;
+        for (uint32_t i = 1; i < 2 + argc; i++) {
+            if (words[pos + i] >= h->n_strings)
+                return false;
+        }
     }
 
-    if (c != '\n') {
-        /* Hit buffer limit.  Artificially terminate line */
-        *lptr++ = '\n';
+    trace_t *t = malloc_or_fail(sizeof(trace_t), "load_trace");
+    t->words = words;
+    t->n_words = h->n_words;
+    t->pos = 0;
+    t->n_strings = h->n_strings;
+    t->strs = calloc_or_fail(t->n_strings + 1, sizeof(char *), "load_trace");
+    t->cmds = calloc_or_fail(t->n_strings + 1, sizeof(cmd_element_t *),
+                             "load_trace");
+    t->max_argc = h->max_argc;
+    t->argv = calloc_or_fail(t->max_argc + 1, sizeof(char *), "load_trace");
+
+    for (uint32_t i = 0; i < t->n_strings; i++)
+        t->strs[i] = r->map + offsets[i];
+    for (uint32_t pos = 0; pos < t->n_words; pos += 2 + words[pos]) {
+        /* An empty line has no command word */
+        if (!words[pos])
+            continue;
+        uint32_t cmd = words[pos + 2];
+        if (!t->cmds[cmd])
+            t->cmds[cmd] = name_find(&cmd_table, t->strs[cmd]);
     }
-    *lptr++ = '\0';
+
+    r->trace = t;
+    return true;
+}
+
+static void free_trace(trace_t *t)
+{
+    free_array(t->strs, t->n_strings + 1, sizeof(char *));
+    free_array(t->cmds, t->n_strings + 1, sizeof(cmd_element_t *));
+    free_array(t->argv, t->max_argc + 1, sizeof(char *));
+    free_block(t, sizeof(trace_t));
+}
+
+/* Execute the next record of the compiled trace on top of the stack.
+ * When hit its end, close that file
+ */
+static void replay_next()
+{
+    trace_t *t = buf_stack->trace;
+    if (t->pos == t->n_words) {
+        pop_file();
+        return;
+    }
+
+    const uint32_t *rec = t->words + t->pos;
+    uint32_t argc = rec[0];
+    t->pos += 2 + argc;
 
     if (echo) {
         report_noreturn(1, prompt);
-        report_noreturn(1, linebuf);
+        report_noreturn(1, "%s\n", t->strs[rec[1]]);
+    }
+    if (quit_flag || !argc)
+        return;
+
+    for (uint32_t i = 0; i < argc; i++)
+        t->argv[i] = t->strs[rec[2 + i]];
+    t->argv[argc] = NULL;
+    run_line(t->cmds[rec[2]], argc, t->argv);
+}
+
+/* Growable arrays of compile_trace() and blocks */
+static void *grow_array(void *a, size_t *cap, size_t size)
+{
+    size_t new_cap = *cap ? 2 * *cap : 1024;
+    void *b = malloc_or_fail(new_cap * size, "grow_array");
+    if (a) {
+        memcpy(b, a, *cap * size);
+        free_array(a, *cap, size);
     }
+    *cap = new_cap;
+    return b;
+}
+
+typedef struct {
+    name_table_t table; /* String to its index plus one */
+    char **strs;
+    size_t n_strs, strs_cap;
+    uint32_t *words;
+    size_t n_words, words_cap;
+    size_t bytes; /* Total length of the strings, terminators included */
+} trace_builder_t;
+
+static void add_word(trace_builder_t *b, uint32_t w)
+{
+    if (b->n_words == b->words_cap)
+        b->words = grow_array(b->words, &b->words_cap, sizeof(uint32_t));
+    b->words[b->n_words++] = w;
+}
 
-    return linebuf;
+static uint32_t intern(trace_builder_t *b, const char *s)
+{
+    uintptr_t id = (uintptr_t) name_find(&b->table, s);
+    if (id)
+        return id - 1;
+
+    if (b->n_strs == b->strs_cap)
+        b->strs = grow_array(b->strs, &b->strs_cap, sizeof(char *));
+    char *copy = strsave_or_fail(s, "compile_trace");
+    b->strs[b->n_strs++] = copy;
+    b->bytes += strlen(copy) + 1;
+    name_add(&b->table, copy, (void *) (uintptr_t) b->n_strs);
+    return b->n_strs - 1;
+}
+
+/* Write the compiled form of @b to @outfile_name */
+static bool write_trace(trace_builder_t *b,
+                        uint32_t max_argc,
+                        const char *outfile_name)
+{
+    trace_header_t h = {
+        .magic = TRACE_MAGIC,
+        .n_strings = b->n_strs,
+        .n_words = b->n_words,
+        .max_argc = max_argc,
+    };
+    size_t at = sizeof(h) + (b->n_strs + b->n_words) * sizeof(uint32_t);
+    if (at + b->bytes > UINT32_MAX) {
+        report(1, "Trace too large to compile");
+        return false;
+    }
+
+    FILE *f = fopen(outfile_name, "wb");
+    if (!f) {
+        report(1, "Could not open output file '%s'", outfile_name);
+        return false;
+    }
+
+    bool ok = fwrite(&h, sizeof(h), 1, f) == 1;
+    for (size_t i = 0; ok && i < b->n_strs; i++) {
+        uint32_t offset = at;
+        ok = fwrite(&offset, sizeof(offset), 1, f) == 1;
+        at += strlen(b->strs[i]) + 1;
+    }
+    ok = ok && fwrite(b->words, sizeof(uint32_t), b->n_words, f) == b->n_words;
+    for (size_t i = 0; ok && i < b->n_strs; i++)
+        ok = fwrite(b->strs[i], strlen(b->strs[i]) + 1, 1, f) == 1;
+
+    ok = !fclose(f) && ok;
+    if (!ok)
+        report(1, "Error writing compiled trace '%s'", outfile_name);
+    return ok;
+}
+
+bool compile_trace(const char *infile_name, const char *outfile_name)
+{
+    int fd = open(infile_name, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st)) {
+        report(1, "Could not open source file '%s'", infile_name);
+        if (fd >= 0)
+            close(fd);
+        return false;
+    }
+
+    size_t len = st.st_size;
+    char *text = malloc_or_fail(len + 1, "compile_trace");
+    size_t got = 0;
+    while (got < len) {
+        ssize_t n = read(fd, text + got, len - got);
+        if (n <= 0)
+            break;
+        got += n;
+    }
+    close(fd);
+    len = got;
+    text[len] = '\0';
+
+    trace_builder_t b = {0};
+    char *words = malloc_or_fail(len + 1, "compile_trace");
+    uint32_t max_argc = 0, lines = 0;
+
+    /* Split lines and words as readline() and parse_args() do */
+    for (char *line = text; line < text + len; lines++) {
+        char *nl = memchr(line, '\n', text + len - line);
+        size_t line_len = (nl ? nl : text + len) - line;
+        line[line_len] = '\0';
+
+        uint32_t argc = 0;
+        char *dst = words;
+        bool skipping = true;
+        for (const char *src = line; *src; src++) {
+            if (isspace((unsigned char) *src)) {
+                if (!skipping) {
+                    *dst++ = '\0';
+                    skipping = true;
+                }
+            } else {
+                if (skipping) {
+                    argc++;
+                    skipping = false;
+                }
+                *dst++ = *src;
+            }
+        }
+        *dst = '\0';
+
+        add_word(&b, argc);
+        add_word(&b, intern(&b, line));
+        char *word = words;
+        for (uint32_t i = 0; i < argc; i++) {
+            add_word(&b, intern(&b, word));
+            word += strlen(word) + 1;
+        }
+        if (argc > max_argc)
+            max_argc = argc;
+
+        line += line_len + 1;
+    }
+
+    bool ok = write_trace(&b, max_argc, outfile_name);
+    if (ok)
+        report(2, "Compiled %u lines of '%s' into '%s'", lines, infile_name,
+               outfile_name);
+
+    for (size_t i = 0; i < b.n_strs; i++)
+        free_string(b.strs[i]);
+    if (b.strs)
+        free_array(b.strs, b.strs_cap, sizeof(char *));
+    if (b.words)
+        free_array(b.words, b.words_cap, sizeof(uint32_t));
+    name_clear(&b.table);
+    free_block(words, len + 1);
+    free_block(text, st.st_size + 1);
+    return ok;
+}
+
+static bool do_compile(int argc, char *argv[])
+{
+    if (argc != 3) {
+        report(1, "%s needs 2 arguments", argv[0]);
+        return false;
+    }
+    return compile_trace(argv[1], argv[2]);
+}
+
+/* Command language
+ *
+ * "let NAME = EXPR" sets an integer variable, and an argument "$NAME" stands
+ * for its value. "repeat EXPR {" and "choose {" open blocks, which a line
+ * holding only "}" closes. Each line of a choose block starts with a weight,
+ * and running the block runs one of its lines, picked with a probability
+ * proportional to its weight.
+ *
+ * A block is collected whole, then compiled into statements with commands
+ * and variables already looked up, so however many times it runs, its lines
+ * are neither read nor split again.
+ */
+
+typedef struct __var {
+    char *name;
+    long value;
+    char text[24]; /* The value as an argument, kept up to date */
+    struct __var *next;
+} var_t;
+
+static var_t *var_list = NULL;
+static name_table_t var_table;
+
+/* Operands and operators of an expression, in postfix order */
+typedef struct {
+    char op;    /* '+', '-', '*', '/' or '%', 0 for an operand */
+    long value; /* Operand, unless read from var */
+    var_t *var;
+} expr_item_t;
+
+typedef struct {
+    expr_item_t *items;
+    int n;
+} expr_t;
+
+typedef enum {
+    STMT_CMD,
+    STMT_LET,
+    STMT_REPEAT,
+    STMT_CHOOSE,
+} stmt_kind_t;
+
+typedef struct __stmt {
+    stmt_kind_t kind;
+    int argc;
+    char **argv; /* Words of the line, with variables pointing at their text */
+    cmd_element_t *cmd;
+    var_t *target;       /* Variable set by let */
+    expr_t expr;         /* Value of let, count of repeat */
+    uint64_t weight;     /* Weight as an entry of choose */
+    uint64_t total;      /* Sum of the weights of the entries of choose */
+    struct __stmt *body; /* Statements of repeat, entries of choose */
+    struct __stmt *next;
+} stmt_t;
+
+/* Lines of the block being collected */
+typedef struct {
+    int argc;
+    char **words;
+} block_line_t;
+
+static block_line_t *block_lines = NULL;
+static size_t n_block_lines = 0, block_lines_cap = 0;
+static int block_depth = 0; /* Blocks opened and not closed yet */
+
+static bool get_long(const char *s, long *loc)
+{
+    char *end = NULL;
+    errno = 0;
+    long v = strtol(s, &end, 0);
+    if (errno || end == s || *end != '\0')
+        return false;
+
+    *loc = v;
+    return true;
+}
+
+static void set_var(var_t *v, long value)
+{
+    v->value = value;
+    snprintf(v->text, sizeof(v->text), "%ld", value);
+}
+
+/* Variable named @name, created with value 0 if there is none */
+static var_t *add_var(const char *name)
+{
+    var_t *v = name_find(&var_table, name);
+    if (v)
+        return v;
+
+    v = malloc_or_fail(sizeof(var_t), "add_var");
+    v->name = strsave_or_fail(name, "add_var");
+    set_var(v, 0);
+    v->next = var_list;
+    var_list = v;
+    name_add(&var_table, v->name, v);
+    return v;
+}
+
+static void free_vars()
+{
+    while (var_list) {
+        var_t *v = var_list;
+        var_list = v->next;
+        free_string(v->name);
+        free_block(v, sizeof(var_t));
+    }
+    name_clear(&var_table);
+}
+
+static bool valid_var_name(const char *s)
+{
+    if (!isalpha((unsigned char) *s) && *s != '_')
+        return false;
+    while (*++s)
+        if (!isalnum((unsigned char) *s) && *s != '_')
+            return false;
+    return true;
+}
+
+/* Point the arguments of the form $NAME at the text of variable NAME */
+static bool resolve_vars(int argc, char *argv[])
+{
+    for (int i = 1; i < argc; i++) {
+        if (argv[i][0] != '$')
+            continue;
+        var_t *v = name_find(&var_table, argv[i] + 1);
+        if (!v) {
+            report(1, "Unknown variable '%s'", argv[i]);
+            return false;
+        }
+        argv[i] = v->text;
+    }
+    return true;
+}
+
+static int op_prec(char op)
+{
+    switch (op) {
+    case '+':
+    case '-':
+        return 1;
+    case '*':
+    case '/':
+    case '%':
+        return 2;
+    default:
+        return 0;
+    }
+}
+
+/* Compile the words of an infix expression, operands and operators
+ * alternating, into postfix order
+ */
+static bool compile_expr(expr_t *e, int argc, char *argv[])
+{
+    if (argc % 2 == 0) {
+        report(1, "Malformed expression");
+        return false;
+    }
+
+    e->items = malloc_or_fail(argc * sizeof(expr_item_t), "compile_expr");
+    e->n = argc;
+
+    /* With two levels of left-associative operators, at most one operator
+     * of each level waits for its right operand
+     */
+    char ops[2];
+    int n_ops = 0, n = 0;
+    for (int i = 0; i < argc; i++) {
+        expr_item_t *item = &e->items[n];
+        if (i % 2 == 0) {
+            item->op = 0;
+            item->var = NULL;
+            item->value = 0;
+            if (argv[i][0] == '$') {
+                item->var = name_find(&var_table, argv[i] + 1);
+                if (!item->var) {
+                    report(1, "Unknown variable '%s'", argv[i]);
+                    return false;
+                }
+            } else if (!get_long(argv[i], &item->value)) {
+                report(1, "Cannot parse '%s' as integer", argv[i]);
+                return false;
+            }
+            n++;
+            continue;
+        }
+
+        int prec = argv[i][1] ? 0 : op_prec(argv[i][0]);
+        if (!prec) {
+            report(1, "Unknown operator '%s'", argv[i]);
+            return false;
+        }
+        while (n_ops && op_prec(ops[n_ops - 1]) >= prec)
+            e->items[n++].op = ops[--n_ops];
+        ops[n_ops++] = argv[i][0];
+    }
+    while (n_ops)
+        e->items[n++].op = ops[--n_ops];
+    return true;
+}
+
+static bool eval_expr(const expr_t *e, long *result)
+{
+    /* Two pending operators hold at most three operands */
+    unsigned long stack[3];
+    int depth = 0;
+    for (int i = 0; i < e->n; i++) {
+        const expr_item_t *item = &e->items[i];
+        if (!item->op) {
+            stack[depth++] = item->var ? item->var->value : item->value;
+            continue;
+        }
+
+        /* Wrap around on overflow rather than invoke undefined behavior */
+        unsigned long b = stack[--depth], a = stack[depth - 1];
+        if ((item->op == '/' || item->op == '%') && !b) {
+            report(1, "Division by zero");
+            return false;
+        }
+        switch (item->op) {
+        case '+':
+            a += b;
+            break;
+        case '-':
+            a -= b;
+            break;
+        case '*':
+            a *= b;
+            break;
+        case '/':
+            a = (long) b == -1 ? -a : (unsigned long) ((long) a / (long) b);
+            break;
+        case '%':
+            a = (long) b == -1 ? 0 : (unsigned long) ((long) a % (long) b);
+            break;
+        }
+        stack[depth - 1] = a;
+    }
+    *result = (long) stack[0];
+    return true;
+}
+
+static void free_stmts(stmt_t *s)
+{
+    while (s) {
+        stmt_t *next = s->next;
+        free_stmts(s->body);
+        if (s->expr.items)
+            free_array(s->expr.items, s->expr.n, sizeof(expr_item_t));
+        if (s->argv)
+            free_array(s->argv, s->argc + 1, sizeof(char *));
+        free_block(s, sizeof(stmt_t));
+        s = next;
+    }
+}
+
+static bool compile_stmt(stmt_t *s, size_t *i, bool entry);
+
+/* Compile block lines from *@i into a list of statements, up to the "}"
+ * closing them. Entries of choose when @entries.
+ */
+static bool compile_list(stmt_t **list, size_t *i, bool entries)
+{
+    while (*i < n_block_lines) {
+        const block_line_t *l = &block_lines[*i];
+        if (l->argc == 1 && !strcmp(l->words[0], "}")) {
+            (*i)++;
+            return true;
+        }
+        if (!strcmp(l->words[0], "#")) {
+            (*i)++;
+            continue;
+        }
+
+        stmt_t *s = calloc_or_fail(1, sizeof(stmt_t), "compile_list");
+        *list = s;
+        list = &s->next;
+        if (!compile_stmt(s, i, entries))
+            return false;
+    }
+    return true;
+}
+
+static bool compile_let(stmt_t *s, int argc, char *argv[])
+{
+    if (argc != 2 && (argc < 4 || strcmp(argv[2], "="))) {
+        report(1, "Usage: let NAME [= EXPR]");
+        return false;
+    }
+    if (!valid_var_name(argv[1])) {
+        report(1, "Invalid variable name '%s'", argv[1]);
+        return false;
+    }
+    if (argc == 2) {
+        s->target = name_find(&var_table, argv[1]);
+        if (!s->target) {
+            report(1, "Unknown variable '%s'", argv[1]);
+            return false;
+        }
+        return true;
+    }
+
+    /* Created after its value compiles, so "let x = $x" needs x to exist */
+    if (!compile_expr(&s->expr, argc - 3, argv + 3))
+        return false;
+    s->target = add_var(argv[1]);
+    return true;
+}
+
+/* Compile block line *@i, and the lines of the block it opens if any */
+static bool compile_stmt(stmt_t *s, size_t *i, bool entry)
+{
+    const block_line_t *l = &block_lines[(*i)++];
+    int argc = l->argc;
+    char **argv = l->words;
+
+    if (entry) {
+        long weight;
+        if (argc < 2 || !get_long(argv[0], &weight) || weight < 0) {
+            report(1, "Lines of choose need a weight and a command");
+            return false;
+        }
+        s->weight = weight;
+        argc--;
+        argv++;
+    }
+
+    bool opens = !strcmp(argv[argc - 1], "{");
+    if (!strcmp(argv[0], "repeat")) {
+        s->kind = STMT_REPEAT;
+        if (!opens) {
+            report(1, "Usage: repeat EXPR {");
+            return false;
+        }
+        return compile_expr(&s->expr, argc - 2, argv + 1) &&
+               compile_list(&s->body, i, false);
+    }
+    if (!strcmp(argv[0], "choose")) {
+        s->kind = STMT_CHOOSE;
+        if (argc != 2 || !opens) {
+            report(1, "Usage: choose {");
+            return false;
+        }
+        if (!compile_list(&s->body, i, true))
+            return false;
+        for (const stmt_t *e = s->body; e; e = e->next)
+            s->total += e->weight;
+        if (!s->total) {
+            report(1, "choose needs a positive weight");
+            return false;
+        }
+        return true;
+    }
+    if (opens) {
+        report(1, "Unknown block '%s'", argv[0]);
+        return false;
+    }
+    if (!strcmp(argv[0], "let")) {
+        s->kind = STMT_LET;
+        return compile_let(s, argc, argv);
+    }
+
+    s->kind = STMT_CMD;
+    s->cmd = name_find(&cmd_table, argv[0]);
+    if (!s->cmd) {
+        report(1, "Unknown command '%s'", argv[0]);
+        return false;
+    }
+    s->argc = argc;
+    s->argv = malloc_or_fail((argc + 1) * sizeof(char *), "compile_stmt");
+    memcpy(s->argv, argv, argc * sizeof(char *));
+    s->argv[argc] = NULL;
+    return resolve_vars(argc, s->argv);
+}
+
+static bool exec_let(const stmt_t *s)
+{
+    if (!s->expr.n) {
+        report(1, "%s = %ld", s->target->name, s->target->value);
+        return true;
+    }
+
+    long value;
+    if (!eval_expr(&s->expr, &value))
+        return false;
+    set_var(s->target, value);
+    return true;
+}
+
+static bool exec_stmts(stmt_t *s);
+
+/* Errors are recorded here, as run_cmd() does for commands */
+static bool exec_stmt(stmt_t *s)
+{
+    long n;
+    switch (s->kind) {
+    case STMT_CMD:
+        return run_cmd(s->cmd, s->argc, s->argv);
+    case STMT_LET:
+        if (!exec_let(s)) {
+            record_error();
+            return false;
+        }
+        return true;
+    case STMT_REPEAT: {
+        if (!eval_expr(&s->expr, &n)) {
+            record_error();
+            return false;
+        }
+        bool ok = true;
+        for (long k = 0; k < n && !quit_flag; k++)
+            ok = exec_stmts(s->body) && ok;
+        return ok;
+    }
+    case STMT_CHOOSE: {
+        /* A stream of its own, so the choices only depend on the seed */
+        static prng_stream_t stream = {.id = 3};
+        uint64_t r = prng_below(prng_stream(&stream), s->total);
+        stmt_t *e = s->body;
+        while (r >= e->weight) {
+            r -= e->weight;
+            e = e->next;
+        }
+        return exec_stmt(e);
+    }
+    }
+    return false;
+}
+
+/* Run statements, stopping early when the console quits, as it frees the
+ * commands they refer to
+ */
+static bool exec_stmts(stmt_t *s)
+{
+    bool ok = true;
+    for (; s && !quit_flag; s = s->next)
+        ok = exec_stmt(s) && ok;
+    return ok;
+}
+
+/* Drop the lines collected. Return whether a block was left open. */
+static bool discard_block()
+{
+    for (size_t i = 0; i < n_block_lines; i++) {
+        block_line_t *l = &block_lines[i];
+        for (int j = 0; j < l->argc; j++)
+            free_string(l->words[j]);
+        free_array(l->words, l->argc, sizeof(char *));
+    }
+    if (block_lines)
+        free_array(block_lines, block_lines_cap, sizeof(block_line_t));
+    block_lines = NULL;
+    n_block_lines = block_lines_cap = 0;
+
+    bool open = block_depth > 0;
+    block_depth = 0;
+    return open;
+}
+
+/* Add a line to the block being collected, and once the outermost block
+ * closes, compile and run it
+ */
+static bool collect_line(int argc, char *argv[])
+{
+    if (!argc)
+        return true;
+
+    if (n_block_lines == block_lines_cap)
+        block_lines =
+            grow_array(block_lines, &block_lines_cap, sizeof(block_line_t));
+    block_line_t *l = &block_lines[n_block_lines++];
+    l->argc = argc;
+    l->words = malloc_or_fail(argc * sizeof(char *), "collect_line");
+    for (int i = 0; i < argc; i++)
+        l->words[i] = strsave_or_fail(argv[i], "collect_line");
+
+    if (argc == 1 && !strcmp(argv[0], "}"))
+        block_depth--;
+    else if (strcmp(argv[0], "#") && !strcmp(argv[argc - 1], "{"))
+        block_depth++;
+    if (block_depth > 0)
+        return true;
+
+    /* The statements point into the lines, which are dropped last */
+    stmt_t *s = calloc_or_fail(1, sizeof(stmt_t), "collect_line");
+    size_t i = 0;
+    bool ok = compile_stmt(s, &i, false);
+    if (ok) {
+        bool counted = perf_begin();
+        ok = exec_stmt(s);
+        if (counted)
+            perf_end(s->kind == STMT_REPEAT ? "repeat" : "choose");
+    } else
+        record_error();
+    free_stmts(s);
+    discard_block();
+    return ok;
+}
+
+/* Execute a command line split into arguments, @next_cmd being the command
+ * argv[0] names, unless a block is being collected
+ */
+static bool run_line(cmd_element_t *next_cmd, int argc, char *argv[])
+{
+    if (block_depth)
+        return collect_line(argc, argv);
+
+    if (next_cmd && next_cmd->operation != do_comment_cmd &&
+        !resolve_vars(argc, argv)) {
+        record_error();
+        return false;
+    }
+
+    /* bench counts the runs it times itself, and blocks are counted once
+     * they are complete
+     */
+    if (!next_cmd || next_cmd->operation == do_bench ||
+        next_cmd->operation == do_repeat || next_cmd->operation == do_choose ||
+        !perf_begin())
+        return run_cmd(next_cmd, argc, argv);
+    const char *name = next_cmd->name; /* argv is gone if it quits */
+    bool ok = run_cmd(next_cmd, argc, argv);
+    perf_end(name);
+    return ok;
+}
+
+static bool do_let(int argc, char *argv[])
+{
+    stmt_t s = {0};
+    bool ok = compile_let(&s, argc, argv) && exec_let(&s);
+    if (s.expr.items)
+        free_array(s.expr.items, s.expr.n, sizeof(expr_item_t));
+    return ok;
+}
+
+static bool do_repeat(int argc, char *argv[])
+{
+    if (argc < 3 || strcmp(argv[argc - 1], "{")) {
+        report(1, "Usage: repeat EXPR {");
+        return false;
+    }
+    return collect_line(argc, argv);
+}
+
+static bool do_choose(int argc, char *argv[])
+{
+    if (argc != 2 || strcmp(argv[1], "{")) {
+        report(1, "Usage: choose {");
+        return false;
+    }
+    return collect_line(argc, argv);
 }
 
 static bool cmd_done()
@@ -598,10 +1839,13 @@ static int cmd_select(int nfds,
                 interpret_cmd(cmdline);
             fflush(stdout);
             prompt_flag = true;
+        } else if (buf_stack->trace) {
+            replay_next();
         } else if (infd != STDIN_FILENO) {
-            char *cmdline = readline();
+            size_t len;
+            char *cmdline = readline(&len);
             if (cmdline)
-                interpret_cmd(cmdline);
+                interpret_line(cmdline, len);
         }
     }
     return 0;
@@ -56,6 +56,17 @@ bool get_int(char *vname, int *loc);
 /* Add function to be executed as part of program exit */
 void add_quit_helper(cmd_func_t qf);
 
+/* Function saving, restoring or discarding a copy of program state */
+typedef bool (*snapshot_func_t)(void);
+
+/* Set the functions "bench -r" uses to run a command on the same state each
+ * time: @save before the runs, @restore after each run, and @discard at the
+ * end. Restoring keeps the copy for the next run.
+ */
+void set_snapshot_helpers(snapshot_func_t save,
+                          snapshot_func_t restore,
+                          snapshot_func_t discard);
+
 /* Turn echoing on/off */
 void set_echo(bool on);
 
@@ -68,6 +79,11 @@ bool finish_cmd();
  */
 bool run_console(char *infile_name);
 
+/* Compile trace @infile_name into a file which -f and source replay faster,
+ * with identical output. Return true if successful.
+ */
+bool compile_trace(const char *infile_name, const char *outfile_name);
+
 /* Callback function to complete command by linenoise */
 void completion(const char *buf, line_completions_t *lc);
 
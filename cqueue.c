@@ -0,0 +1,471 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "cqueue.h"
+
+#define CQ_INIT_NODES 16
+#define CQ_INIT_STRS 256
+
+/* Compact the string arena once removed strings take more room than live
+ * ones, but not before there is enough to be worth a copy.
+ */
+#define CQ_COMPACT_MIN 4096
+
+/* Largest capacity addressable with 32-bit indices and offsets */
+#define CQ_MAX_CAP UINT32_MAX
+
+/* Grow @*cap so that it holds at least @need items of @size bytes, doubling
+ * it to keep insertions amortized O(1).
+ */
+static bool grow(void **buf, uint32_t *cap, size_t need, size_t size)
+{
+    if (need <= *cap)
+        return true;
+    if (need > CQ_MAX_CAP)
+        return false;
+
+    size_t new_cap = (size_t) *cap * 2;
+    if (new_cap < need)
+        new_cap = need;
+    if (new_cap > CQ_MAX_CAP)
+        new_cap = CQ_MAX_CAP;
+
+    void *p = realloc(*buf, new_cap * size);
+    if (!p)
+        return false;
+    *buf = p;
+    *cap = new_cap;
+    return true;
+}
+
+/* Make room for @nodes more nodes and @bytes more string bytes */
+static bool reserve(cqueue_t *q, size_t nodes, size_t bytes)
+{
+    return grow((void **) &q->nodes, &q->node_cap,
+                (size_t) q->node_used + nodes, sizeof(cq_node_t)) &&
+           grow((void **) &q->strs, &q->str_cap, (size_t) q->str_used + bytes,
+                1);
+}
+
+/* Drop all elements but keep the arenas for reuse */
+static void reset(cqueue_t *q)
+{
+    q->nodes[CQ_HEAD].next = q->nodes[CQ_HEAD].prev = CQ_HEAD;
+    q->node_used = 1;
+    q->free_node = CQ_HEAD;
+    q->size = 0;
+    q->str_used = q->str_dead = 0;
+}
+
+/* Copy the live strings, in queue order, to a fresh arena of the same size.
+ * Nothing happens if that arena cannot be allocated; the dead bytes are then
+ * simply kept until a later attempt.
+ */
+static void compact(cqueue_t *q)
+{
+    char *strs = malloc(q->str_cap);
+    if (!strs)
+        return;
+
+    uint32_t used = 0;
+    cq_index_t i;
+    cq_for_each(i, q) {
+        const char *s = cq_value(q, i);
+        size_t len = strlen(s) + 1;
+        memcpy(strs + used, s, len);
+        q->nodes[i].value = used;
+        used += len;
+    }
+
+    free(q->strs);
+    q->strs = strs;
+    q->str_used = used;
+    q->str_dead = 0;
+}
+
+/* Add a copy of @s between the nodes @prev and @next */
+static bool insert(cqueue_t *q, const char *s, cq_index_t prev, cq_index_t next)
+{
+    if (!q || !s)
+        return false;
+
+    size_t len = strlen(s) + 1;
+    if (q->str_dead >= CQ_COMPACT_MIN &&
+        q->str_dead > q->str_used - q->str_dead)
+        compact(q);
+    if (!reserve(q, q->free_node == CQ_HEAD, len))
+        return false;
+
+    cq_index_t i;
+    if (q->free_node != CQ_HEAD) {
+        i = q->free_node;
+        q->free_node = q->nodes[i].next;
+    } else {
+        i = q->node_used++;
+    }
+
+    cq_node_t *n = q->nodes;
+    n[i].value = q->str_used;
+    memcpy(q->strs + q->str_used, s, len);
+    q->str_used += len;
+
+    n[i].prev = prev;
+    n[i].next = next;
+    n[prev].next = i;
+    n[next].prev = i;
+    q->size++;
+    return true;
+}
+
+/* Unlink node @i and put it on the free list */
+static void remove_node(cqueue_t *q, cq_index_t i)
+{
+    cq_node_t *n = q->nodes;
+
+    n[n[i].prev].next = n[i].next;
+    n[n[i].next].prev = n[i].prev;
+    if (--q->size == 0) {
+        reset(q);
+        return;
+    }
+
+    q->str_dead += strlen(cq_value(q, i)) + 1;
+    n[i].next = q->free_node;
+    q->free_node = i;
+}
+
+cqueue_t *cq_new(void)
+{
+    cqueue_t *q = malloc(sizeof(cqueue_t));
+    if (!q)
+        return NULL;
+
+    q->nodes = malloc(CQ_INIT_NODES * sizeof(cq_node_t));
+    q->strs = malloc(CQ_INIT_STRS);
+    if (!q->nodes || !q->strs) {
+        free(q->nodes);
+        free(q->strs);
+        free(q);
+        return NULL;
+    }
+
+    q->node_cap = CQ_INIT_NODES;
+    q->str_cap = CQ_INIT_STRS;
+    reset(q);
+    return q;
+}
+
+void cq_free(cqueue_t *q)
+{
+    if (!q)
+        return;
+
+    free(q->nodes);
+    free(q->strs);
+    free(q);
+}
+
+bool cq_insert_head(cqueue_t *q, const char *s)
+{
+    return q && insert(q, s, CQ_HEAD, cq_first(q));
+}
+
+bool cq_insert_tail(cqueue_t *q, const char *s)
+{
+    return q && insert(q, s, cq_last(q), CQ_HEAD);
+}
+
+static bool remove_copy(cqueue_t *q, cq_index_t i, char *sp, size_t bufsize)
+{
+    if (sp && bufsize > 0) {
+        const char *s = cq_value(q, i);
+        size_t len = strnlen(s, bufsize - 1);
+        memcpy(sp, s, len);
+        sp[len] = '\0';
+    }
+    remove_node(q, i);
+    return true;
+}
+
+bool cq_remove_head(cqueue_t *q, char *sp, size_t bufsize)
+{
+    if (!q || !q->size)
+        return false;
+    return remove_copy(q, cq_first(q), sp, bufsize);
+}
+
+bool cq_remove_tail(cqueue_t *q, char *sp, size_t bufsize)
+{
+    if (!q || !q->size)
+        return false;
+    return remove_copy(q, cq_last(q), sp, bufsize);
+}
+
+size_t cq_footprint(const cqueue_t *q, size_t *used)
+{
+    if (!q) {
+        if (used)
+            *used = 0;
+        return 0;
+    }
+
+    if (used)
+        *used = sizeof(cqueue_t) + (q->size + 1) * sizeof(cq_node_t) +
+                q->str_used - q->str_dead;
+    return sizeof(cqueue_t) + (size_t) q->node_cap * sizeof(cq_node_t) +
+           q->str_cap;
+}
+
+bool cq_delete_mid(cqueue_t *q)
+{
+    if (!q || !q->size)
+        return false;
+
+    /* Same node as the slow/fast walk of q_delete_mid(): index size / 2 */
+    cq_index_t i = cq_first(q);
+    for (uint32_t steps = q->size / 2; steps; steps--)
+        i = cq_next(q, i);
+    remove_node(q, i);
+    return true;
+}
+
+bool cq_delete_dup(cqueue_t *q)
+{
+    if (!q || !q->size)
+        return false;
+
+    cq_index_t cur = cq_first(q);
+    while (cur != CQ_HEAD) {
+        bool duplicated = false;
+        cq_index_t next;
+
+        while ((next = cq_next(q, cur)) != CQ_HEAD &&
+               !strcmp(cq_value(q, cur), cq_value(q, next))) {
+            duplicated = true;
+            remove_node(q, next);
+        }
+
+        if (duplicated)
+            remove_node(q, cur);
+        cur = next;
+    }
+    return true;
+}
+
+void cq_swap(cqueue_t *q)
+{
+    if (!q || q->size < 2)
+        return;
+
+    cq_node_t *n = q->nodes;
+    cq_index_t prev = CQ_HEAD, first = n[CQ_HEAD].next;
+
+    while (first != CQ_HEAD && n[first].next != CQ_HEAD) {
+        cq_index_t second = n[first].next, next = n[second].next;
+
+        n[prev].next = second;
+        n[second].prev = prev;
+        n[second].next = first;
+        n[first].prev = second;
+        n[first].next = next;
+        n[next].prev = first;
+
+        prev = first;
+        first = next;
+    }
+}
+
+void cq_reverse(cqueue_t *q)
+{
+    if (!q || q->size < 2)
+        return;
+
+    cq_node_t *n = q->nodes;
+    cq_index_t i = CQ_HEAD;
+    do {
+        cq_index_t next = n[i].next;
+        n[i].next = n[i].prev;
+        n[i].prev = next;
+        i = next;
+    } while (i != CQ_HEAD);
+}
+
+void cq_reverseK(cqueue_t *q, int k)
+{
+    if (!q || !q->size || k <= 1)
+        return;
+
+    cq_node_t *n = q->nodes;
+    cq_index_t pre = CQ_HEAD;
+
+    for (uint32_t g = q->size / k; g; g--) {
+        cq_index_t start = n[pre].next, cur = start, last = n[start].next;
+
+        /* Find the node following the group */
+        for (int j = 1; j < k; j++)
+            last = n[last].next;
+
+        /* Point each node of the group back at its predecessor, the first
+         * one at the node following the group.
+         */
+        cq_index_t prev = last;
+        for (int j = 0; j < k; j++) {
+            cq_index_t next = n[cur].next;
+            n[cur].next = prev;
+            n[prev].prev = cur;
+            prev = cur;
+            cur = next;
+        }
+        n[pre].next = prev;
+        n[prev].prev = pre;
+
+        pre = start;
+    }
+}
+
+/* Return whether node @a has to be placed after node @b */
+static inline bool sorts_after(const cqueue_t *q,
+                               cq_index_t a,
+                               cq_index_t b,
+                               bool descend)
+{
+    int cmp = strcmp(cq_value(q, a), cq_value(q, b));
+    return descend ? cmp < 0 : cmp > 0;
+}
+
+/* Merge two runs linked through @next and terminated by CQ_HEAD, @a holding
+ * the nodes that came first so that ties keep their order.
+ */
+static cq_index_t merge(cqueue_t *q, cq_index_t a, cq_index_t b, bool descend)
+{
+    cq_node_t *n = q->nodes;
+    cq_index_t head = CQ_HEAD, *tail = &head;
+
+    for (;;) {
+        if (sorts_after(q, a, b, descend)) {
+            *tail = b;
+            tail = &n[b].next;
+            b = n[b].next;
+            if (b == CQ_HEAD) {
+                *tail = a;
+                break;
+            }
+        } else {
+            *tail = a;
+            tail = &n[a].next;
+            a = n[a].next;
+            if (a == CQ_HEAD) {
+                *tail = b;
+                break;
+            }
+        }
+    }
+    return head;
+}
+
+/* Bottom-up merge sort following list_sort(), with indices in place of
+ * pointers: the sentinel being index 0, the last node's next link already
+ * terminates the run the same way NULL does there.
+ */
+void cq_sort(cqueue_t *q, bool descend)
+{
+    if (!q || q->size < 2)
+        return;
+
+    cq_node_t *n = q->nodes;
+    cq_index_t list = n[CQ_HEAD].next, pending = CQ_HEAD;
+    size_t count = 0;
+
+    do {
+        cq_index_t *tail = &pending;
+        size_t bits;
+
+        for (bits = count; bits & 1; bits >>= 1)
+            tail = &n[*tail].prev;
+
+        if (bits) {
+            cq_index_t a = *tail, b = n[a].prev;
+            a = merge(q, b, a, descend);
+            n[a].prev = n[b].prev;
+            *tail = a;
+        }
+
+        n[list].prev = pending;
+        pending = list;
+        list = n[list].next;
+        n[pending].next = CQ_HEAD;
+        count++;
+    } while (list != CQ_HEAD);
+
+    list = pending;
+    pending = n[pending].prev;
+    while (pending != CQ_HEAD) {
+        cq_index_t next = n[pending].prev;
+        list = merge(q, pending, list, descend);
+        pending = next;
+    }
+
+    /* Restore the prev links and close the ring */
+    cq_index_t prev = CQ_HEAD;
+    n[CQ_HEAD].next = list;
+    for (cq_index_t i = list; i != CQ_HEAD; i = n[i].next) {
+        n[i].prev = prev;
+        prev = i;
+    }
+    n[CQ_HEAD].prev = prev;
+}
+
+/* Remove every node followed by a node it @descend ? precedes : follows */
+static int monotone(cqueue_t *q, bool descend)
+{
+    if (!q)
+        return 0;
+    if (q->size < 2)
+        return q->size;
+
+    cq_index_t right = cq_last(q), left = cq_prev(q, right);
+    while (left != CQ_HEAD) {
+        int cmp = strcmp(cq_value(q, left), cq_value(q, right));
+        if (descend ? cmp >= 0 : cmp <= 0) {
+            right = left;
+            left = cq_prev(q, left);
+        } else {
+            remove_node(q, left);
+            left = cq_prev(q, right);
+        }
+    }
+    return q->size;
+}
+
+int cq_ascend(cqueue_t *q)
+{
+    return monotone(q, false);
+}
+
+int cq_descend(cqueue_t *q)
+{
+    return monotone(q, true);
+}
+
+int cq_merge(cqueue_t *dst, cqueue_t *src, bool descend)
+{
+    if (!dst)
+        return 0;
+    if (!src || src == dst || !src->size) {
+        cq_sort(dst, descend);
+        return dst->size;
+    }
+
+    /* Reserve everything up front so that the copy cannot fail halfway */
+    if ((size_t) dst->size + src->size > CQ_MAX_CAP - 1 ||
+        !reserve(dst, src->size, src->str_used - src->str_dead))
+        return -1;
+
+    cq_index_t i;
+    cq_for_each(i, src)
+        insert(dst, cq_value(src, i), cq_last(dst), CQ_HEAD);
+    reset(src);
+
+    cq_sort(dst, descend);
+    return dst->size;
+}
@@ -0,0 +1,186 @@
+#ifndef LAB0_CQUEUE_H
+#define LAB0_CQUEUE_H
+
+/* Compact queue of strings
+ *
+ * Same operations as queue.h, but instead of one element_t and one string
+ * allocation per element, nodes live in a single growable array and are linked
+ * by 32-bit indices, while strings are packed back to back in a second array.
+ * A node takes 12 bytes plus its string and no per-element malloc header,
+ * against 16 bytes of list_head, 8 bytes of value pointer and two malloc
+ * headers for element_t.
+ *
+ * Indices stay valid when the arrays are reallocated; pointers returned by
+ * cq_value() do not survive the next insertion, and must not be passed to the
+ * insertion functions of the same queue.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef uint32_t cq_index_t;
+
+/* Index of the sentinel node, which plays the role of the list head */
+#define CQ_HEAD ((cq_index_t) 0)
+
+/**
+ * cq_node_t - Node of a compact queue
+ * @next: index of the next node
+ * @prev: index of the previous node
+ * @value: offset of the string in the string arena
+ */
+typedef struct {
+    cq_index_t next, prev;
+    uint32_t value;
+} cq_node_t;
+
+/**
+ * cqueue_t - Compact queue
+ * @nodes: node arena, nodes[CQ_HEAD] is the sentinel
+ * @node_cap: number of slots in @nodes
+ * @node_used: number of slots handed out so far, sentinel included
+ * @free_node: first slot of the free list chained through @next, or CQ_HEAD
+ * @size: number of elements
+ * @strs: string arena
+ * @str_cap: size of @strs in bytes
+ * @str_used: bytes handed out so far
+ * @str_dead: bytes belonging to removed elements, reclaimed by compaction
+ */
+typedef struct {
+    cq_node_t *nodes;
+    cq_index_t node_cap, node_used, free_node;
+    uint32_t size;
+    char *strs;
+    uint32_t str_cap, str_used, str_dead;
+} cqueue_t;
+
+static inline cq_index_t cq_first(const cqueue_t *q)
+{
+    return q->nodes[CQ_HEAD].next;
+}
+
+static inline cq_index_t cq_last(const cqueue_t *q)
+{
+    return q->nodes[CQ_HEAD].prev;
+}
+
+static inline cq_index_t cq_next(const cqueue_t *q, cq_index_t i)
+{
+    return q->nodes[i].next;
+}
+
+static inline cq_index_t cq_prev(const cqueue_t *q, cq_index_t i)
+{
+    return q->nodes[i].prev;
+}
+
+static inline const char *cq_value(const cqueue_t *q, cq_index_t i)
+{
+    return q->strs + q->nodes[i].value;
+}
+
+/**
+ * cq_for_each - iterate over the nodes of a compact queue
+ * @i: cq_index_t to use as a loop cursor
+ * @q: the queue
+ */
+#define cq_for_each(i, q) \
+    for (i = cq_first(q); i != CQ_HEAD; i = cq_next(q, i))
+
+/**
+ * cq_new() - Create an empty compact queue
+ *
+ * Return: NULL for allocation failed
+ */
+cqueue_t *cq_new(void);
+
+/**
+ * cq_free() - Free all storage used by a compact queue, no effect if NULL
+ * @q: the queue
+ */
+void cq_free(cqueue_t *q);
+
+/**
+ * cq_insert_head() - Insert a copy of @s at the head of the queue
+ * @q: the queue
+ * @s: string to insert
+ *
+ * Return: false for NULL queue or string, or when the arenas cannot grow
+ */
+bool cq_insert_head(cqueue_t *q, const char *s);
+
+/**
+ * cq_insert_tail() - Insert a copy of @s at the tail of the queue
+ * @q: the queue
+ * @s: string to insert
+ *
+ * Return: false for NULL queue or string, or when the arenas cannot grow
+ */
+bool cq_insert_tail(cqueue_t *q, const char *s);
+
+/**
+ * cq_remove_head() - Remove the element at the head of the queue
+ * @q: the queue
+ * @sp: buffer receiving up to @bufsize - 1 characters of the string, may be
+ *      NULL
+ * @bufsize: size of @sp
+ *
+ * Return: false for NULL or empty queue
+ */
+bool cq_remove_head(cqueue_t *q, char *sp, size_t bufsize);
+
+/**
+ * cq_remove_tail() - Remove the element at the tail of the queue
+ * @q: the queue
+ * @sp: buffer receiving up to @bufsize - 1 characters of the string, may be
+ *      NULL
+ * @bufsize: size of @sp
+ *
+ * Return: false for NULL or empty queue
+ */
+bool cq_remove_tail(cqueue_t *q, char *sp, size_t bufsize);
+
+/**
+ * cq_size() - Get the number of elements, in constant time
+ * @q: the queue
+ *
+ * Return: the number of elements, 0 for NULL queue
+ */
+static inline int cq_size(const cqueue_t *q)
+{
+    return q ? (int) q->size : 0;
+}
+
+/**
+ * cq_footprint() - Bytes of memory held by a compact queue
+ * @q: the queue
+ * @used: if not NULL, receives the bytes actually in use by live elements
+ *
+ * Return: the bytes reserved by the queue, its descriptor included
+ */
+size_t cq_footprint(const cqueue_t *q, size_t *used);
+
+/* The operations below behave as their q_ counterparts in queue.h */
+
+bool cq_delete_mid(cqueue_t *q);
+bool cq_delete_dup(cqueue_t *q);
+void cq_swap(cqueue_t *q);
+void cq_reverse(cqueue_t *q);
+void cq_reverseK(cqueue_t *q, int k);
+void cq_sort(cqueue_t *q, bool descend);
+int cq_ascend(cqueue_t *q);
+int cq_descend(cqueue_t *q);
+
+/**
+ * cq_merge() - Move all elements of @src into @dst and sort the result
+ * @dst: destination queue
+ * @src: queue emptied into @dst
+ * @descend: whether to sort in descending order
+ *
+ * Return: the number of elements in @dst, or -1 when @dst cannot grow, in
+ * which case both queues are left unchanged
+ */
+int cq_merge(cqueue_t *dst, cqueue_t *src, bool descend);
+
+#endif /* LAB0_CQUEUE_H */
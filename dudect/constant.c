@@ -12,36 +12,64 @@
  */
 static struct list_head *l = NULL;
 
-#define dut_new() ((void) (l = q_new()))
-
-#define dut_size(n)                                \
-    do {                                           \
-        for (int __iter = 0; __iter < n; ++__iter) \
-            q_size(l);                             \
-    } while (0)
-
-#define dut_insert_head(s, n)    \
-    do {                         \
-        int j = n;               \
-        while (j--)              \
-            q_insert_head(l, s); \
-    } while (0)
-
-#define dut_insert_tail(s, n)    \
-    do {                         \
-        int j = n;               \
-        while (j--)              \
-            q_insert_tail(l, s); \
-    } while (0)
-
-#define dut_free() ((void) (q_free(l)))
+/* Largest queue a measurement is taken on */
+#define DUT_MAX_SIZE 10000
+
+/* Nodes built once per test and relinked into a queue of the requested length
+ * before each measurement, so that setting up a sample costs pointer writes
+ * instead of thousands of allocations, and the allocator is left alone while
+ * measuring.
+ */
+static struct list_head *pool[DUT_MAX_SIZE];
+
+/* Number of pooled nodes linked by the last dut_attach() */
+static size_t attached;
 
 static char random_string[N_MEASURES][8];
 static int random_string_iter = 0;
 
 /* Implement the necessary queue interface to simulation */
-void init_dut(void)
+bool init_dut(void)
+{
+    l = q_new();
+    if (!l)
+        return false;
+
+    for (size_t i = 0; i < DUT_MAX_SIZE; i++) {
+        if (!q_insert_tail(l, "dudect"))
+            goto fail;
+        pool[i] = l->prev;
+    }
+    return true;
+
+fail:
+    q_free(l);
+    l = NULL;
+    return false;
+}
+
+/* Link the first @n pooled nodes into the queue, undoing whatever the previous
+ * measurement did to them
+ */
+static void dut_attach(size_t n)
+{
+    struct list_head *prev = l;
+    for (size_t i = 0; i < n; i++) {
+        prev->next = pool[i];
+        pool[i]->prev = prev;
+        prev = pool[i];
+    }
+    prev->next = l;
+    l->prev = prev;
+    attached = n;
+}
+
+void free_dut(void)
 {
+    if (!l)
+        return;
+    dut_attach(DUT_MAX_SIZE);
+    q_free(l);
     l = NULL;
 }
 
@@ -53,7 +81,7 @@ static char *get_random_string(void)
 
 void prepare_inputs(uint8_t *input_data, uint8_t *classes)
 {
-    randombytes(input_data, N_MEASURES * CHUNK_SIZE);
+    random_fill(input_data, N_MEASURES * CHUNK_SIZE);
     for (size_t i = 0; i < N_MEASURES; i++) {
         classes[i] = randombit();
         if (classes[i] == 0)
@@ -62,101 +90,186 @@ void prepare_inputs(uint8_t *input_data, uint8_t *classes)
 
     for (size_t i = 0; i < N_MEASURES; ++i) {
         /* Generate random string */
-        randombytes((uint8_t *) random_string[i], 7);
+        random_fill(random_string[i], 7);
         random_string[i][7] = 0;
     }
 }
 
+/* Queue length a measurement is taken on, encoded in its input chunk */
+static size_t input_size(const uint8_t *input_data, size_t i)
+{
+    return *(uint16_t *) (input_data + i * CHUNK_SIZE) % DUT_MAX_SIZE;
+}
+
+/* Devices under test. Each registers three callbacks:
+ *  - setup: put the queue in the state a measurement starts from, given the
+ *    length drawn for the sample
+ *  - run: the timed operation
+ *  - teardown: check the outcome from the queue length before and after the
+ *    operation, and leave every pooled node either linked in the queue or
+ *    untouched so that the next dut_attach() recovers it
+ */
+typedef struct {
+    void (*setup)(size_t n);
+    void (*run)(void);
+    bool (*teardown)(int before_size, int after_size);
+} dut_t;
+
+static char *dut_string;
+static int dut_result;
+
+static void dut_insert_setup(size_t n)
+{
+    dut_string = get_random_string();
+    dut_attach(n);
+}
+
+#define dut_insert_head_setup dut_insert_setup
+#define dut_insert_tail_setup dut_insert_setup
+
+static void dut_insert_head_run(void)
+{
+    q_insert_head(l, dut_string);
+}
+
+static void dut_insert_tail_run(void)
+{
+    q_insert_tail(l, dut_string);
+}
+
+/* Only the new node goes back to the allocator */
+static bool dut_insert_head_teardown(int before_size, int after_size)
+{
+    if (before_size != after_size - 1)
+        return false;
+    element_t *e = q_remove_head(l, NULL, 0);
+    if (attached && &e->list == pool[0])
+        return false;
+    q_release_element(e);
+    return true;
+}
+
+static bool dut_insert_tail_teardown(int before_size, int after_size)
+{
+    if (before_size != after_size - 1)
+        return false;
+    element_t *e = q_remove_tail(l, NULL, 0);
+    if (attached && &e->list == pool[attached - 1])
+        return false;
+    q_release_element(e);
+    return true;
+}
+
+/* Operations taking a node out need one to start with */
+static void dut_nonempty_setup(size_t n)
+{
+    dut_attach(n + 1);
+}
+
+#define dut_remove_head_setup dut_nonempty_setup
+#define dut_remove_tail_setup dut_nonempty_setup
+#define dut_delete_mid_setup dut_nonempty_setup
+
+static void dut_remove_head_run(void)
+{
+    q_remove_head(l, NULL, 0);
+}
+
+static void dut_remove_tail_run(void)
+{
+    q_remove_tail(l, NULL, 0);
+}
+
+/* The removed node stays in the pool */
+static bool dut_remove_teardown(int before_size, int after_size)
+{
+    return before_size == after_size + 1;
+}
+
+#define dut_remove_head_teardown dut_remove_teardown
+#define dut_remove_tail_teardown dut_remove_teardown
+
+static void dut_size_setup(size_t n)
+{
+    dut_attach(n);
+}
+
+static void dut_size_run(void)
+{
+    dut_result = q_size(l);
+}
+
+static bool dut_size_teardown(int before_size, int after_size)
+{
+    return dut_result == before_size && before_size == after_size;
+}
+
+static void dut_delete_mid_run(void)
+{
+    q_delete_mid(l);
+}
+
+/* The deleted node was freed, a new one takes its place in the pool */
+static bool dut_delete_mid_teardown(int before_size, int after_size)
+{
+    if (before_size != after_size + 1)
+        return false;
+
+    size_t k = 0;
+    struct list_head *node;
+    list_for_each(node, l) {
+        if (node != pool[k])
+            break;
+        k++;
+    }
+    if (!q_insert_tail(l, "dudect"))
+        return false;
+    pool[k] = l->prev;
+    return true;
+}
+
+static const dut_t duts[] = {
+#define _(x) [DUT(x)] = {dut_##x##_setup, dut_##x##_run, dut_##x##_teardown},
+    DUT_FUNCS
+#undef _
+};
+
+static volatile uintptr_t dut_sink;
+
+/* Bring the caches to the same state whatever the queue length: read every
+ * pooled node, linked or not, then the nodes around the head, where the
+ * operations under test work. Otherwise a class 1 sample, whose setup went
+ * over up to DUT_MAX_SIZE nodes, starts with colder caches than a class 0
+ * one, and the difference is reported as a leak of the operation.
+ */
+static void dut_warm(void)
+{
+    uintptr_t x = 0;
+    for (size_t i = 0; i < DUT_MAX_SIZE; i++)
+        x += (uintptr_t) pool[i]->next;
+    x += (uintptr_t) l->next->next->next;
+    x += (uintptr_t) l->prev->prev->prev;
+    dut_sink = x;
+}
+
 bool measure(int64_t *before_ticks,
              int64_t *after_ticks,
              uint8_t *input_data,
              int mode)
 {
-    assert(mode == DUT(insert_head) || mode == DUT(insert_tail) ||
-           mode == DUT(remove_head) || mode == DUT(remove_tail));
-
-    switch (mode) {
-    case DUT(insert_head):
-        for (size_t i = DROP_SIZE; i < N_MEASURES - DROP_SIZE; i++) {
-            char *s = get_random_string();
-            dut_new();
-            dut_insert_head(
-                get_random_string(),
-                *(uint16_t *) (input_data + i * CHUNK_SIZE) % 10000);
-            int before_size = q_size(l);
-            before_ticks[i] = cpucycles();
-            dut_insert_head(s, 1);
-            after_ticks[i] = cpucycles();
-            int after_size = q_size(l);
-            dut_free();
-            if (before_size != after_size - 1)
-                return false;
-        }
-        break;
-    case DUT(insert_tail):
-        for (size_t i = DROP_SIZE; i < N_MEASURES - DROP_SIZE; i++) {
-            char *s = get_random_string();
-            dut_new();
-            dut_insert_head(
-                get_random_string(),
-                *(uint16_t *) (input_data + i * CHUNK_SIZE) % 10000);
-            int before_size = q_size(l);
-            before_ticks[i] = cpucycles();
-            dut_insert_tail(s, 1);
-            after_ticks[i] = cpucycles();
-            int after_size = q_size(l);
-            dut_free();
-            if (before_size != after_size - 1)
-                return false;
-        }
-        break;
-    case DUT(remove_head):
-        for (size_t i = DROP_SIZE; i < N_MEASURES - DROP_SIZE; i++) {
-            dut_new();
-            dut_insert_head(
-                get_random_string(),
-                *(uint16_t *) (input_data + i * CHUNK_SIZE) % 10000 + 1);
-            int before_size = q_size(l);
-            before_ticks[i] = cpucycles();
-            element_t *e = q_remove_head(l, NULL, 0);
-            after_ticks[i] = cpucycles();
-            int after_size = q_size(l);
-            if (e)
-                q_release_element(e);
-            dut_free();
-            if (before_size != after_size + 1)
-                return false;
-        }
-        break;
-    case DUT(remove_tail):
-        for (size_t i = DROP_SIZE; i < N_MEASURES - DROP_SIZE; i++) {
-            dut_new();
-            dut_insert_head(
-                get_random_string(),
-                *(uint16_t *) (input_data + i * CHUNK_SIZE) % 10000 + 1);
-            int before_size = q_size(l);
-            before_ticks[i] = cpucycles();
-            element_t *e = q_remove_tail(l, NULL, 0);
-            after_ticks[i] = cpucycles();
-            int after_size = q_size(l);
-            if (e)
-                q_release_element(e);
-            dut_free();
-            if (before_size != after_size + 1)
-                return false;
-        }
-        break;
-    default:
-        for (size_t i = DROP_SIZE; i < N_MEASURES - DROP_SIZE; i++) {
-            dut_new();
-            dut_insert_head(
-                get_random_string(),
-                *(uint16_t *) (input_data + i * CHUNK_SIZE) % 10000);
-            before_ticks[i] = cpucycles();
-            dut_size(1);
-            after_ticks[i] = cpucycles();
-            dut_free();
-        }
+    assert(mode >= 0 && mode < (int) (sizeof(duts) / sizeof(duts[0])));
+    const dut_t *dut = &duts[mode];
+
+    for (size_t i = DROP_SIZE; i < N_MEASURES - DROP_SIZE; i++) {
+        dut->setup(input_size(input_data, i));
+        int before_size = q_size(l);
+        dut_warm();
+        before_ticks[i] = cpucycles_begin();
+        dut->run();
+        after_ticks[i] = cpucycles_end();
+        int after_size = q_size(l);
+        if (!dut->teardown(before_size, after_size))
+            return false;
     }
     return true;
 }
@@ -12,11 +12,16 @@
 
 #define DROP_SIZE 20
 
+/* Operations with a dudect test. Registering one takes an entry here and its
+ * setup/run/teardown callbacks in constant.c.
+ */
 #define DUT_FUNCS  \
     _(insert_head) \
     _(insert_tail) \
     _(remove_head) \
-    _(remove_tail)
+    _(remove_tail) \
+    _(size)        \
+    _(delete_mid)
 
 #define DUT(x) DUT_##x
 
@@ -26,7 +31,11 @@ enum {
 #undef _
 };
 
-void init_dut();
+/* Build the nodes measurements are taken on, once per test.
+ * Return false for allocation failed.
+ */
+bool init_dut(void);
+void free_dut(void);
 void prepare_inputs(uint8_t *input_data, uint8_t *classes);
 bool measure(int64_t *before_ticks,
              int64_t *after_ticks,
@@ -0,0 +1,109 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "cpucycles.h"
+
+int cpucycles_clock = CPUCYCLES_FENCED;
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static int perf_fd = -1;
+
+/* Page the kernel publishes the counter index and offset in, for rdpmc */
+static struct perf_event_mmap_page *perf_page;
+static size_t perf_page_size;
+
+bool cpucycles_perf_open(void)
+{
+    if (perf_fd >= 0)
+        return true;
+
+    struct perf_event_attr attr = {
+        .type = PERF_TYPE_HARDWARE,
+        .size = sizeof(attr),
+        .config = PERF_COUNT_HW_CPU_CYCLES,
+        .exclude_kernel = 1,
+        .exclude_hv = 1,
+    };
+    perf_fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (perf_fd < 0)
+        return false;
+
+    /* Without the page, reads fall back to read(2) */
+    perf_page_size = sysconf(_SC_PAGESIZE);
+    perf_page = mmap(NULL, perf_page_size, PROT_READ, MAP_SHARED, perf_fd, 0);
+    if (perf_page == MAP_FAILED)
+        perf_page = NULL;
+    return true;
+}
+
+void cpucycles_perf_close(void)
+{
+    if (perf_fd < 0)
+        return;
+    if (perf_page)
+        munmap(perf_page, perf_page_size);
+    perf_page = NULL;
+    close(perf_fd);
+    perf_fd = -1;
+}
+
+int64_t cpucycles_perf(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+    /* Self-monitoring sequence of perf_event_open(2): retry when the kernel
+     * updated the page, e.g. after the thread migrated, while it was read.
+     */
+    if (perf_page && perf_page->cap_user_rdpmc) {
+        uint32_t seq, idx;
+        int64_t count;
+        do {
+            seq = perf_page->lock;
+            __asm__ volatile("" : : : "memory");
+            idx = perf_page->index;
+            count = perf_page->offset;
+            if (idx) {
+                unsigned int hi, lo;
+                __asm__ volatile("lfence\n\trdpmc\n\tlfence\n\t"
+                                 : "=a"(lo), "=d"(hi)
+                                 : "c"(idx - 1)
+                                 : "memory");
+                /* Only pmc_width bits are valid, sign-extend them */
+                int shift = 64 - perf_page->pmc_width;
+                int64_t pmc = (int64_t) (((uint64_t) hi << 32) | lo);
+                count += (int64_t) ((uint64_t) pmc << shift) >> shift;
+            }
+            __asm__ volatile("" : : : "memory");
+        } while (perf_page->lock != seq);
+
+        /* A zero index means the counter is not on the PMU right now */
+        if (idx)
+            return count;
+    }
+#endif
+
+    uint64_t count;
+    if (perf_fd < 0 || read(perf_fd, &count, sizeof(count)) != sizeof(count))
+        return 0;
+    return count;
+}
+
+#else
+
+bool cpucycles_perf_open(void)
+{
+    return false;
+}
+
+void cpucycles_perf_close(void) {}
+
+int64_t cpucycles_perf(void)
+{
+    return 0;
+}
+
+#endif
@@ -1,8 +1,19 @@
 #ifndef DUDECT_CPUCYCLES_H
 #define DUDECT_CPUCYCLES_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
+/* Counters the fixture can time measurements with */
+enum {
+    CPUCYCLES_TSC,    /* bare counter reads, which the CPU may reorder */
+    CPUCYCLES_FENCED, /* counter reads ordered against the timed code */
+    CPUCYCLES_PERF,   /* cycle counter of perf_event_open(2), Linux only */
+};
+
+/* Counter used by cpucycles_begin() and cpucycles_end() */
+extern int cpucycles_clock;
+
 // http://www.intel.com/content/www/us/en/embedded/training/ia-32-ia-64-benchmark-code-execution-paper.html
 static inline int64_t cpucycles(void)
 {
@@ -26,4 +37,87 @@ static inline int64_t cpucycles(void)
 #endif
 }
 
+/* Counter read opening a timed region: it waits for all earlier instructions
+ * to complete, and no later instruction starts before it.
+ */
+static inline int64_t cpucycles_start(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+    unsigned int hi, lo;
+    __asm__ volatile("lfence\n\trdtsc\n\tlfence\n\t"
+                     : "=a"(lo), "=d"(hi)
+                     :
+                     : "memory");
+    return ((int64_t) lo) | (((int64_t) hi) << 32);
+#elif defined(__aarch64__)
+    uint64_t val;
+    asm volatile("isb\n\tmrs %0, cntvct_el0\n\tisb" : "=r"(val) : : "memory");
+    return val;
+#else
+#error Unsupported Architecture
+#endif
+}
+
+/* Counter read closing a timed region: rdtscp waits for the timed code to
+ * complete, and the fence keeps later instructions out of the region.
+ */
+static inline int64_t cpucycles_stop(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+    unsigned int hi, lo, aux;
+    __asm__ volatile("rdtscp\n\tlfence\n\t"
+                     : "=a"(lo), "=d"(hi), "=c"(aux)
+                     :
+                     : "memory");
+    return ((int64_t) lo) | (((int64_t) hi) << 32);
+#elif defined(__aarch64__)
+    uint64_t val;
+    asm volatile("isb\n\tmrs %0, cntvct_el0\n\tisb" : "=r"(val) : : "memory");
+    return val;
+#else
+#error Unsupported Architecture
+#endif
+}
+
+/**
+ * cpucycles_perf_open() - Open the cycle counter of perf_event_open(2)
+ *
+ * The counter counts the cycles of the calling thread in user space. On x86
+ * it is read with rdpmc when the kernel allows it, and with read(2) otherwise.
+ *
+ * Return: false when the counter is not available, e.g. outside Linux or when
+ * perf_event_paranoid forbids it
+ */
+bool cpucycles_perf_open(void);
+
+/**
+ * cpucycles_perf_close() - Release the counter, no effect if not opened
+ */
+void cpucycles_perf_close(void);
+
+/**
+ * cpucycles_perf() - Read the counter opened by cpucycles_perf_open()
+ *
+ * Return: cycles counted so far, 0 if the counter cannot be read
+ */
+int64_t cpucycles_perf(void);
+
+static inline int64_t cpucycles_begin(void)
+{
+    if (cpucycles_clock == CPUCYCLES_PERF)
+        return cpucycles_perf();
+    if (cpucycles_clock == CPUCYCLES_TSC)
+        return cpucycles();
+    return cpucycles_start();
+}
+
+static inline int64_t cpucycles_end(void)
+{
+    if (cpucycles_clock == CPUCYCLES_PERF)
+        return cpucycles_perf();
+    if (cpucycles_clock == CPUCYCLES_TSC)
+        return cpucycles();
+    return cpucycles_stop();
+}
+
 #endif
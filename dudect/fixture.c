@@ -23,10 +23,13 @@
  *    measurements (non-linear transform)
  *
  *  - as long as any of the different test fails, the code will be deemed
- *    variable time.
+ *    variable time. The cropped tests are many and strongly correlated, so
+ *    that one of them passes the usual threshold by chance much more often
+ *    than a single test does; they are held to a higher one.
  */
 
 #include <assert.h>
+#include <inttypes.h>
 #include <math.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -37,18 +40,56 @@
 #include "../random.h"
 
 #include "constant.h"
+#include "cpucycles.h"
 #include "fixture.h"
 #include "ttest.h"
 
 #define ENOUGH_MEASURE 10000
 #define TEST_TRIES 10
 
+/* Cropping thresholds, placed from the first batches of each try. A single
+ * batch leaves the thresholds reaching into the tail resting on one or two
+ * measurements.
+ */
+#define N_PERCENTILES 100
+#define PERCENTILE_BATCHES 5
+
+/* Tests are the uncropped one, one per percentile, and the second order one */
+#define N_TESTS (1 + N_PERCENTILES + 1)
+#define T_SECOND_ORDER (N_TESTS - 1)
+
+/* Measurements the uncropped test needs before its mean is trusted to center
+ * samples for the second order test
+ */
+#define SECOND_ORDER_WARMUP 1000
+
+/* Tests with fewer measurements are left out of the verdict */
+#define MIN_TEST_MEASURE 500
+
+/* Empty timed regions measured to estimate the cost of reading the counter */
+#define CALIBRATION_ROUNDS 10000
+
 static t_context_t *t;
 
+/* Cost of an empty timed region with the counter in use, and its standard
+ * deviation. The overhead is taken off every measurement.
+ */
+static int64_t overhead;
+static double overhead_sd;
+
+/* Buffers of a batch, allocated once per test and reused by every batch */
+static int64_t *before_ticks, *after_ticks, *exec_times;
+static uint8_t *classes, *input_data;
+static int64_t percentiles[N_PERCENTILES];
+static int64_t percentile_samples[PERCENTILE_BATCHES * N_MEASURES];
+static size_t n_percentile_samples;
+static int percentile_batches;
+
 /* threshold values for Welch's t-test */
 enum {
     t_threshold_bananas = 500, /* Test failed with overwhelming probability */
     t_threshold_moderate = 10, /* Test failed */
+    t_threshold_cropped = 30,  /* Test on cropped measurements failed */
 };
 
 static void __attribute__((noreturn)) die(void)
@@ -64,6 +105,64 @@ static void differentiate(int64_t *exec_times,
         exec_times[i] = after_ticks[i] - before_ticks[i];
 }
 
+static int cmp_int64(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *) a, y = *(const int64_t *) b;
+    return (x > y) - (x < y);
+}
+
+/* Time empty regions exactly as measure() times an operation. The median is
+ * the overhead; the deviation leaves out the slowest percent, which mostly
+ * reflects interrupts rather than the counter.
+ */
+static void calibrate(void)
+{
+    static int64_t samples[CALIBRATION_ROUNDS];
+
+    for (size_t i = 0; i < CALIBRATION_ROUNDS; i++) {
+        int64_t before = cpucycles_begin();
+        int64_t after = cpucycles_end();
+        samples[i] = after - before;
+    }
+    qsort(samples, CALIBRATION_ROUNDS, sizeof(int64_t), cmp_int64);
+    overhead = samples[CALIBRATION_ROUNDS / 2];
+
+    t_context_t c;
+    t_init(&c);
+    for (size_t i = 0; i < CALIBRATION_ROUNDS * 99 / 100; i++)
+        t_push(&c, samples[i], 0);
+    overhead_sd = sqrt(c.m2[0] / (c.n[0] - 1));
+}
+
+/* Collect the measurements of a batch, and once PERCENTILE_BATCHES are in,
+ * set the cropping thresholds so that test i keeps the fastest
+ * 1 - 0.5^(10 * (i + 1) / N_PERCENTILES) of them: many thresholds close to
+ * the bulk of the distribution, a few reaching into its tail.
+ */
+static void prepare_percentiles(const int64_t *exec_times)
+{
+    int64_t *sorted = percentile_samples;
+    size_t n = n_percentile_samples;
+    for (size_t i = 0; i < N_MEASURES; i++) {
+        if (exec_times[i] > 0)
+            sorted[n++] = exec_times[i];
+    }
+    n_percentile_samples = n;
+    if (++percentile_batches < PERCENTILE_BATCHES || !n)
+        return;
+
+    qsort(sorted, n, sizeof(int64_t), cmp_int64);
+    for (size_t i = 0; i < N_PERCENTILES; i++) {
+        double which = 1 - pow(0.5, 10 * (double) (i + 1) / N_PERCENTILES);
+        percentiles[i] = sorted[(size_t) (which * n)];
+    }
+}
+
+static bool have_percentiles(void)
+{
+    return percentile_batches >= PERCENTILE_BATCHES && n_percentile_samples;
+}
+
 static void update_statistics(const int64_t *exec_times, uint8_t *classes)
 {
     for (size_t i = 0; i < N_MEASURES; i++) {
@@ -73,21 +172,66 @@ static void update_statistics(const int64_t *exec_times, uint8_t *classes)
             continue;
 
         /* do a t-test on the execution time */
-        t_push(t, difference, classes[i]);
+        t_push(&t[0], difference - overhead, classes[i]);
+
+        /* do a t-test on cropped execution times, for several thresholds */
+        for (size_t crop = 0; crop < N_PERCENTILES; crop++) {
+            if (difference < percentiles[crop])
+                t_push(&t[crop + 1], difference - overhead, classes[i]);
+        }
+
+        /* second-order test, on the squared deviation from the class mean,
+         * which only makes sense once the mean is known
+         */
+        if (t[0].n[0] + t[0].n[1] > SECOND_ORDER_WARMUP) {
+            double centered =
+                difference - overhead - t[0].mean[classes[i]];
+            t_push(&t[T_SECOND_ORDER], centered * centered, classes[i]);
+        }
+    }
+}
+
+static bool is_cropped(size_t i)
+{
+    return i >= 1 && i <= N_PERCENTILES;
+}
+
+/* Test with the largest |t| among those with enough measurements. Set @leak
+ * when any of them exceeds its threshold.
+ */
+static t_context_t *max_test(bool *leak)
+{
+    t_context_t *max = &t[0];
+    double max_t = fabs(t_compute(max));
+    *leak = max_t > t_threshold_moderate;
+
+    for (size_t i = 1; i < N_TESTS; i++) {
+        if (t[i].n[0] + t[i].n[1] < MIN_TEST_MEASURE)
+            continue;
+        double x = fabs(t_compute(&t[i]));
+        if (x > (is_cropped(i) ? t_threshold_cropped : t_threshold_moderate))
+            *leak = true;
+        if (x > max_t) {
+            max_t = x;
+            max = &t[i];
+        }
     }
+    return max;
 }
 
 static bool report(void)
 {
-    double max_t = fabs(t_compute(t));
-    double number_traces_max_t = t->n[0] + t->n[1];
+    bool leak;
+    t_context_t *test = max_test(&leak);
+    double max_t = fabs(t_compute(test));
+    double number_traces_max_t = test->n[0] + test->n[1];
     double max_tau = max_t / sqrt(number_traces_max_t);
 
     printf("\033[A\033[2K");
-    printf("measure: %7.2lf M, ", (number_traces_max_t / 1e6));
-    if (number_traces_max_t < ENOUGH_MEASURE) {
+    printf("measure: %7.2lf M, ", ((t[0].n[0] + t[0].n[1]) / 1e6));
+    if (t[0].n[0] + t[0].n[1] < ENOUGH_MEASURE) {
         printf("not enough measurements (%.0f still to go).\n",
-               ENOUGH_MEASURE - number_traces_max_t);
+               ENOUGH_MEASURE - (t[0].n[0] + t[0].n[1]));
         return false;
     }
 
@@ -109,7 +253,7 @@ static bool report(void)
         return false;
 
     /* Probably not constant time. */
-    if (max_t > t_threshold_moderate)
+    if (leak)
         return false;
 
     /* For the moment, maybe constant time. */
@@ -118,55 +262,80 @@ static bool report(void)
 
 static bool doit(int mode)
 {
-    int64_t *before_ticks = calloc(N_MEASURES + 1, sizeof(int64_t));
-    int64_t *after_ticks = calloc(N_MEASURES + 1, sizeof(int64_t));
-    int64_t *exec_times = calloc(N_MEASURES, sizeof(int64_t));
-    uint8_t *classes = calloc(N_MEASURES, sizeof(uint8_t));
-    uint8_t *input_data = calloc(N_MEASURES * CHUNK_SIZE, sizeof(uint8_t));
-
-    if (!before_ticks || !after_ticks || !exec_times || !classes ||
-        !input_data) {
-        die();
-    }
-
+    /* Slots a failed or dropped measurement leaves untouched must not carry
+     * the timings of the previous batch
+     */
+    memset(before_ticks, 0, (N_MEASURES + 1) * sizeof(int64_t));
+    memset(after_ticks, 0, (N_MEASURES + 1) * sizeof(int64_t));
     prepare_inputs(input_data, classes);
 
     bool ret = measure(before_ticks, after_ticks, input_data, mode);
     differentiate(exec_times, before_ticks, after_ticks);
-    update_statistics(exec_times, classes);
+    /* The first batches only serve to place the cropping thresholds */
+    if (!have_percentiles())
+        prepare_percentiles(exec_times);
+    else
+        update_statistics(exec_times, classes);
     ret &= report();
 
-    free(before_ticks);
-    free(after_ticks);
-    free(exec_times);
-    free(classes);
-    free(input_data);
-
     return ret;
 }
 
 static void init_once(void)
 {
-    init_dut();
-    t_init(t);
+    for (size_t i = 0; i < N_TESTS; i++)
+        t_init(&t[i]);
+    n_percentile_samples = 0;
+    percentile_batches = 0;
 }
 
 static bool test_const(char *text, int mode)
 {
     bool result = false;
-    t = malloc(sizeof(t_context_t));
+    t = malloc(N_TESTS * sizeof(t_context_t));
+    before_ticks = calloc(N_MEASURES + 1, sizeof(int64_t));
+    after_ticks = calloc(N_MEASURES + 1, sizeof(int64_t));
+    exec_times = calloc(N_MEASURES, sizeof(int64_t));
+    classes = calloc(N_MEASURES, sizeof(uint8_t));
+    input_data = calloc(N_MEASURES * CHUNK_SIZE, sizeof(uint8_t));
+
+    if (!t || !before_ticks || !after_ticks || !exec_times || !classes ||
+        !input_data || !init_dut()) {
+        die();
+    }
+
+    int clock = cpucycles_clock;
+    if (clock == CPUCYCLES_PERF && !cpucycles_perf_open()) {
+        printf("perf_event_open() cycle counter unavailable, "
+               "using the fenced TSC\n");
+        cpucycles_clock = CPUCYCLES_FENCED;
+    }
+    calibrate();
 
     for (int cnt = 0; cnt < TEST_TRIES; ++cnt) {
-        printf("Testing %s...(%d/%d)\n\n", text, cnt, TEST_TRIES);
+        printf("Testing %s...(%d/%d), timer overhead %" PRId64
+               " +/- %.1f cycles\n\n",
+               text, cnt, TEST_TRIES, overhead, overhead_sd);
         init_once();
-        for (int i = 0; i < ENOUGH_MEASURE / (N_MEASURES - DROP_SIZE * 2) + 1;
+        /* More batches than needed, some spent placing the thresholds */
+        for (int i = 0; i < ENOUGH_MEASURE / (N_MEASURES - DROP_SIZE * 2) +
+                                PERCENTILE_BATCHES + 1;
              ++i)
             result = doit(mode);
         printf("\033[A\033[2K\033[A\033[2K");
         if (result)
             break;
     }
+    if (cpucycles_clock == CPUCYCLES_PERF)
+        cpucycles_perf_close();
+    cpucycles_clock = clock;
+    free_dut();
     free(t);
+    free(before_ticks);
+    free(after_ticks);
+    free(exec_times);
+    free(classes);
+    free(input_data);
     return result;
 }
 
@@ -8,6 +8,7 @@
 #include <string.h>
 #include <unistd.h>
 
+#include "random.h"
 #include "report.h"
 
 /* Our program needs to use regular malloc/free */
@@ -70,7 +71,13 @@ typedef enum {
 /* Should this allocation fail? */
 static bool fail_allocation()
 {
-    double weight = (double) random() / RAND_MAX;
+    /* A stream of its own keeps the data other code draws independent of the
+     * number of allocations made by the queue implementation.
+     */
+    static prng_stream_t stream = {.id = 2};
+
+    /* 53 random bits give a uniform double in [0, 1) */
+    double weight = (prng_next(prng_stream(&stream)) >> 11) * 0x1.0p-53;
     return (weight < 0.01 * fail_probability);
 }
 
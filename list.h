@@ -462,6 +462,145 @@ static inline void list_move_tail(struct list_head *node,
          ++(entry), ++(safe))
 #endif
 
+/**
+ * LIST_PREFETCH_DISTANCE - Look-ahead of the prefetching iterators
+ *
+ * Number of nodes the *_prefetch iterators keep between the node being
+ * visited and the node being prefetched. Larger values hide more memory
+ * latency when the body of the loop is cheap, at the cost of touching nodes
+ * the loop might never reach. Define it before including this header to tune
+ * it for a particular workload.
+ */
+#ifndef LIST_PREFETCH_DISTANCE
+#define LIST_PREFETCH_DISTANCE 4
+#endif
+
+/**
+ * list_prefetch() - Hint that a node is going to be read soon
+ * @ptr: address to fetch into the cache
+ *
+ * list_prefetchw() additionally tells the CPU that the node will be written,
+ * so the cache line can be fetched in exclusive state. Both expand to nothing
+ * more than an evaluation of @ptr when the compiler does not provide
+ * __builtin_prefetch.
+ */
+#if defined(__GNUC__) || defined(__clang__)
+#define list_prefetch(ptr) __builtin_prefetch(ptr)
+#define list_prefetchw(ptr) __builtin_prefetch(ptr, 1)
+#else
+#define list_prefetch(ptr) ((void) (ptr))
+#define list_prefetchw(ptr) ((void) (ptr))
+#endif
+
+/**
+ * list_prefetch_ahead() - Start a look-ahead cursor for prefetching iterators
+ * @node: first node the iteration is going to visit
+ * @head: pointer to the head of the list
+ * @dist: number of nodes to run ahead of @node
+ *
+ * Walks at most @dist nodes past @node, issuing a prefetch for each of them,
+ * and stops early at @head.
+ *
+ * Return: the node @dist positions after @node, or @head if the list ends
+ * first.
+ */
+static inline struct list_head *list_prefetch_ahead(struct list_head *node,
+                                                    const struct list_head *head,
+                                                    int dist)
+{
+    while (dist-- > 0 && node != head) {
+        node = node->next;
+        list_prefetch(node);
+    }
+    return node;
+}
+
+/**
+ * list_prefetch_advance() - Move a look-ahead cursor forward by one node
+ * @ahead: cursor returned by list_prefetch_ahead()
+ * @head: pointer to the head of the list
+ *
+ * The cursor stays on @head once it has reached the end of the list.
+ *
+ * Return: the new position of the cursor
+ */
+static inline struct list_head *list_prefetch_advance(
+    struct list_head *ahead,
+    const struct list_head *head)
+{
+    if (ahead != head) {
+        ahead = ahead->next;
+        list_prefetch(ahead);
+    }
+    return ahead;
+}
+
+/**
+ * list_for_each_prefetch - Iterate over list nodes, prefetching ahead
+ * @node: list_head pointer used as iterator
+ * @head: pointer to the head of the list
+ *
+ * Behaves like list_for_each(), but a hidden cursor runs
+ * LIST_PREFETCH_DISTANCE nodes in front of @node and prefetches each node it
+ * lands on, so the cache misses of the pointer chase overlap with the work
+ * done in the loop body. The same restrictions as list_for_each() apply.
+ */
+#define list_for_each_prefetch(node, head)                                    \
+    for (struct list_head *__ahead = list_prefetch_ahead(                     \
+             node = (head)->next, (head), LIST_PREFETCH_DISTANCE);            \
+         node != (head);                                                      \
+         node = node->next, __ahead = list_prefetch_advance(__ahead, (head)))
+
+/**
+ * list_for_each_entry_prefetch - Iterate over entries, prefetching ahead
+ * @entry: Pointer to the structure type, used as the loop iterator.
+ * @head: Pointer to the list_head structure representing the list head.
+ * @member: Name of the list_head member within the structure type of @entry.
+ *
+ * Prefetching counterpart of list_for_each_entry(). The list must be kept
+ * unmodified while iterating through it.
+ */
+#if __LIST_HAVE_TYPEOF
+#define list_for_each_entry_prefetch(entry, head, member)                    \
+    for (struct list_head *__ahead = list_prefetch_ahead(                    \
+             &(entry = list_entry((head)->next, typeof(*entry), member))     \
+                  ->member,                                                  \
+             (head), LIST_PREFETCH_DISTANCE);                                \
+         &entry->member != (head);                                           \
+         entry = list_entry(entry->member.next, typeof(*entry), member),     \
+        __ahead = list_prefetch_advance(__ahead, (head)))
+#else
+#define list_for_each_entry_prefetch(entry, head, member) \
+    for (entry = (void *) 1; sizeof(struct { int i : -1; }); ++(entry))
+#endif
+
+/**
+ * list_for_each_entry_safe_prefetch - Iterate over entries, allowing removal
+ * @entry: Pointer to the structure type, used as the loop iterator.
+ * @safe: Pointer to the structure type, storing the next entry for safe
+ * iteration.
+ * @head: Pointer to the list_head structure representing the list head.
+ * @member: Name of the list_head member within the structure type of @entry.
+ *
+ * Prefetching counterpart of list_for_each_entry_safe(). Only the current
+ * entry may be removed; the look-ahead cursor always stays past @safe, so it
+ * never points to a node that the loop body has released.
+ */
+#if __LIST_HAVE_TYPEOF
+#define list_for_each_entry_safe_prefetch(entry, safe, head, member)         \
+    for (struct list_head *__ahead = list_prefetch_ahead(                    \
+             &(entry = list_entry((head)->next, typeof(*entry), member))     \
+                  ->member,                                                  \
+             (head), LIST_PREFETCH_DISTANCE + 1);                            \
+         safe = list_entry(entry->member.next, typeof(*entry), member),      \
+        &entry->member != (head);                                            \
+         entry = safe, __ahead = list_prefetch_advance(__ahead, (head)))
+#else
+#define list_for_each_entry_safe_prefetch(entry, safe, head, member) \
+    for (entry = safe = (void *) 1; sizeof(struct { int i : -1; });  \
+         ++(entry), ++(safe))
+#endif
+
 #undef __LIST_HAVE_TYPEOF
 
 #ifdef __cplusplus
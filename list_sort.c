@@ -0,0 +1,181 @@
+#include <string.h>
+
+#include "list_sort.h"
+
+#if defined(__GNUC__) || defined(__clang__)
+#define __sort_inline inline __attribute__((always_inline))
+#else
+#define __sort_inline inline
+#endif
+
+/* How two nodes are ordered: through @cmp when it is set, otherwise by the
+ * string pointed to by the 'char *' found @offset bytes away from each node.
+ *
+ * The sorting routines below are always inlined into list_sort() and
+ * list_sort_str(), so each entry point gets its own copy of the merge loops.
+ * In the copy used by list_sort_str() the test on @cmp folds away and strcmp()
+ * is called directly rather than through a callback.
+ */
+struct sort_ctx {
+    list_cmp_func_t cmp;
+    void *priv;
+    ptrdiff_t offset;
+    bool descend;
+};
+
+static __sort_inline const char *node_key(const struct list_head *node,
+                                          ptrdiff_t offset)
+{
+    return *(char *const *) ((const char *) node + offset);
+}
+
+/* Return whether @a has to be placed after @b */
+static __sort_inline bool sorts_after(const struct sort_ctx ctx,
+                                      const struct list_head *a,
+                                      const struct list_head *b)
+{
+    if (ctx.cmp)
+        return ctx.cmp(ctx.priv, a, b) > 0;
+
+    const char *ka = node_key(a, ctx.offset), *kb = node_key(b, ctx.offset);
+    return (ctx.descend ? strcmp(kb, ka) : strcmp(ka, kb)) > 0;
+}
+
+/* Merge two NULL-terminated runs linked through @next. @a holds the nodes that
+ * came first in the input, so it wins ties and the sort stays stable.
+ */
+static __sort_inline struct list_head *merge(const struct sort_ctx ctx,
+                                             struct list_head *a,
+                                             struct list_head *b)
+{
+    struct list_head *head = NULL, **tail = &head;
+
+    for (;;) {
+        if (sorts_after(ctx, a, b)) {
+            *tail = b;
+            tail = &b->next;
+            b = b->next;
+            if (!b) {
+                *tail = a;
+                break;
+            }
+        } else {
+            *tail = a;
+            tail = &a->next;
+            a = a->next;
+            if (!a) {
+                *tail = b;
+                break;
+            }
+        }
+    }
+    return head;
+}
+
+/* Merge the last two runs into @head, rebuilding the prev links and the
+ * circular structure on the way.
+ */
+static __sort_inline void merge_final(const struct sort_ctx ctx,
+                                      struct list_head *head,
+                                      struct list_head *a,
+                                      struct list_head *b)
+{
+    struct list_head *tail = head, *rest;
+
+    for (;;) {
+        if (sorts_after(ctx, a, b)) {
+            tail->next = b;
+            b->prev = tail;
+            tail = b;
+            b = b->next;
+            if (!b) {
+                rest = a;
+                break;
+            }
+        } else {
+            tail->next = a;
+            a->prev = tail;
+            tail = a;
+            a = a->next;
+            if (!a) {
+                rest = b;
+                break;
+            }
+        }
+    }
+
+    do {
+        tail->next = rest;
+        rest->prev = tail;
+        tail = rest;
+        rest = rest->next;
+    } while (rest);
+
+    tail->next = head;
+    head->prev = tail;
+}
+
+static __sort_inline void sort(const struct sort_ctx ctx, struct list_head *head)
+{
+    struct list_head *list = head->next, *pending = NULL;
+    size_t count = 0;
+
+    /* Zero or one node */
+    if (list == head->prev)
+        return;
+
+    /* Work on a NULL-terminated singly-linked list from here on */
+    head->prev->next = NULL;
+
+    /* 'pending' is a stack of sorted runs, chained through the prev pointer of
+     * their first node. Bit k of 'count' set means a run of 2^k nodes is
+     * pending. Before each new node is pushed, the two runs of size 2^k are
+     * merged, where k is the lowest clear bit of 'count', unless no bit above
+     * it is set. This keeps every merge balanced within 2:1 while deferring
+     * it until a third run of the same size exists, which is what bounds the
+     * number of comparisons.
+     */
+    do {
+        struct list_head **tail = &pending;
+        size_t bits;
+
+        for (bits = count; bits & 1; bits >>= 1)
+            tail = &(*tail)->prev;
+
+        if (bits) {
+            struct list_head *a = *tail, *b = a->prev;
+            a = merge(ctx, b, a);
+            a->prev = b->prev;
+            *tail = a;
+        }
+
+        list->prev = pending;
+        pending = list;
+        list = list->next;
+        pending->next = NULL;
+        count++;
+    } while (list);
+
+    /* End of input: fold all pending runs, smallest first */
+    list = pending;
+    pending = pending->prev;
+    for (;;) {
+        struct list_head *next = pending->prev;
+        if (!next)
+            break;
+        list = merge(ctx, pending, list);
+        pending = next;
+    }
+
+    merge_final(ctx, head, pending, list);
+}
+
+void list_sort(void *priv, struct list_head *head, list_cmp_func_t cmp)
+{
+    sort((struct sort_ctx){.cmp = cmp, .priv = priv}, head);
+}
+
+void list_sort_str(struct list_head *head, ptrdiff_t offset, bool descend)
+{
+    sort((struct sort_ctx){.offset = offset, .descend = descend}, head);
+}
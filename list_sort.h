@@ -0,0 +1,51 @@
+#ifndef LAB0_LIST_SORT_H
+#define LAB0_LIST_SORT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "list.h"
+
+/**
+ * list_cmp_func_t - Comparison callback of list_sort()
+ * @priv: private data passed through from list_sort()
+ * @a: first node to compare
+ * @b: second node to compare
+ *
+ * Return: a value greater than zero if @a should sort after @b, and a value
+ * less than or equal to zero otherwise. Returning zero for equal keys keeps
+ * the sort stable.
+ */
+typedef int (*list_cmp_func_t)(void *priv,
+                               const struct list_head *a,
+                               const struct list_head *b);
+
+/**
+ * list_sort() - Stably sort a list without allocating memory
+ * @priv: private data, passed to @cmp
+ * @head: the list to sort
+ * @cmp: the element comparison function
+ *
+ * Bottom-up merge sort in the manner of the Linux kernel's list_sort(): runs
+ * of 2^k sorted nodes are kept on a stack and merged as soon as doing so keeps
+ * every merge within a 2:1 size ratio. It performs close to n*log2(n) - n
+ * comparisons in the worst case, needs O(1) extra space, and only restores the
+ * prev links during the final merge.
+ */
+void list_sort(void *priv, struct list_head *head, list_cmp_func_t cmp);
+
+/**
+ * list_sort_str() - Stably sort a list by a C string key
+ * @head: the list to sort
+ * @offset: distance in bytes from each list node to a 'char *' member of the
+ *          same structure holding the key
+ * @descend: whether to sort in descending order
+ *
+ * Same algorithm as list_sort(), with the key lookup and strcmp() compiled
+ * into the merge loop instead of going through a callback. For a structure
+ * such as element_t the offset is
+ * offsetof(element_t, value) - offsetof(element_t, list).
+ */
+void list_sort_str(struct list_head *head, ptrdiff_t offset, bool descend);
+
+#endif /* LAB0_LIST_SORT_H */
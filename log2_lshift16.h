@@ -1,8 +1,7 @@
 /*
- * Generate precalculated values of log2 with assumption that arg will be left
- * shifted by 16 bit and return value of log2_lshift16() will be left shifted
- * by 3 bit All that shifts used for avoid of using floating point in
- * calculation.
+ * Precalculated values of log2 with assumption that arg will be left shifted
+ * by 16 bit and return value of log2_lshift16() will be left shifted by 3 bit.
+ * All that shifts used for avoid of using floating point in calculation.
  */
 
 #include <stdint.h>
@@ -10,273 +9,159 @@
 #define LOG2_ARG_SHIFT (1 << 16)
 #define LOG2_RET_SHIFT (1 << 3)
 
+/* The result is a step function of the argument, with eight steps per octave
+ * for large arguments. Each octave [2^e, 2^(e+1)) below LOG2_ARG_SHIFT is cut
+ * into 32 equal slots, addressed by the position of the leading one bit and
+ * the five bits after it. No slot holds more than one step, so the result is
+ * @base, plus one from @threshold on.
+ */
+struct log2_slot {
+    uint16_t threshold;
+    int8_t base;
+};
+
+static const struct log2_slot log2_slots[16 * 32] = {
+    /* [1, 2) */
+    {1, -124}, {1, -124}, {1, -124}, {1, -124}, {1, -124}, {1, -124}, {1, -124},
+    {1, -124}, {1, -124}, {1, -124}, {1, -124}, {1, -124}, {1, -124}, {1, -124},
+    {1, -124}, {1, -124}, {1, -124}, {1, -124}, {1, -124}, {1, -124}, {1, -124},
+    {1, -124}, {1, -124}, {1, -124}, {1, -124}, {1, -124}, {1, -124}, {1, -124},
+    {1, -124}, {1, -124}, {1, -124}, {1, -124},
+    /* [2, 4) */
+    {2, -118}, {2, -118}, {2, -118}, {2, -118}, {2, -118}, {2, -118}, {2, -118},
+    {2, -118}, {2, -118}, {2, -118}, {2, -118}, {2, -118}, {2, -118}, {2, -118},
+    {2, -118}, {2, -118}, {3, -114}, {3, -114}, {3, -114}, {3, -114}, {3, -114},
+    {3, -114}, {3, -114}, {3, -114}, {3, -114}, {3, -114}, {3, -114}, {3, -114},
+    {3, -114}, {3, -114}, {3, -114}, {3, -114},
+    /* [4, 8) */
+    {4, -111}, {4, -111}, {4, -111}, {4, -111}, {4, -111}, {4, -111}, {4, -111},
+    {4, -111}, {5, -109}, {5, -109}, {5, -109}, {5, -109}, {5, -109}, {5, -109},
+    {5, -109}, {5, -109}, {6, -107}, {6, -107}, {6, -107}, {6, -107}, {6, -107},
+    {6, -107}, {6, -107}, {6, -107}, {7, -105}, {7, -105}, {7, -105}, {7, -105},
+    {7, -105}, {7, -105}, {7, -105}, {7, -105},
+    /* [8, 16) */
+    {8, -104}, {8, -104}, {8, -104}, {8, -104}, {9, -103}, {9, -103}, {9, -103},
+    {9, -103}, {10, -101}, {10, -101}, {10, -101}, {10, -101}, {11, -100},
+    {11, -100}, {11, -100}, {11, -100}, {12, -99}, {12, -99}, {12, -99},
+    {12, -99}, {13, -98}, {13, -98}, {13, -98}, {13, -98}, {14, -98}, {14, -98},
+    {14, -98}, {14, -98}, {15, -97}, {15, -97}, {15, -97}, {15, -97},
+    /* [16, 32) */
+    {16, -96}, {16, -96}, {17, -95}, {17, -95}, {18, -95}, {18, -95}, {19, -94},
+    {19, -94}, {20, -94}, {20, -94}, {21, -93}, {21, -93}, {22, -93}, {22, -93},
+    {23, -92}, {23, -92}, {24, -92}, {24, -92}, {25, -91}, {25, -91}, {26, -91},
+    {26, -91}, {27, -90}, {27, -90}, {28, -90}, {28, -90}, {29, -89}, {29, -89},
+    {30, -89}, {30, -89}, {31, -89}, {31, -89},
+    /* [32, 64) */
+    {32, -88}, {33, -88}, {34, -88}, {35, -87}, {36, -87}, {37, -87}, {38, -86},
+    {39, -86}, {40, -86}, {41, -85}, {42, -85}, {43, -85}, {44, -85}, {45, -84},
+    {46, -84}, {47, -84}, {48, -84}, {49, -83}, {50, -83}, {51, -83}, {52, -83},
+    {53, -83}, {54, -82}, {55, -82}, {56, -82}, {57, -82}, {58, -82}, {59, -81},
+    {60, -81}, {61, -81}, {62, -81}, {63, -81},
+    /* [64, 128) */
+    {64, -80}, {66, -80}, {68, -80}, {70, -79}, {72, -79}, {74, -79}, {76, -78},
+    {78, -78}, {80, -78}, {83, -77}, {84, -77}, {86, -77}, {88, -77}, {91, -76},
+    {92, -76}, {94, -76}, {96, -76}, {99, -75}, {100, -75}, {102, -75},
+    {104, -75}, {106, -75}, {108, -74}, {110, -74}, {112, -74}, {114, -74},
+    {117, -73}, {118, -73}, {120, -73}, {122, -73}, {124, -73}, {126, -73},
+    /* [128, 256) */
+    {128, -72}, {132, -72}, {136, -72}, {140, -71}, {144, -71}, {148, -71},
+    {152, -70}, {156, -70}, {160, -70}, {166, -69}, {168, -69}, {172, -69},
+    {176, -69}, {181, -68}, {184, -68}, {188, -68}, {192, -68}, {197, -67},
+    {200, -67}, {204, -67}, {208, -67}, {215, -66}, {216, -66}, {220, -66},
+    {224, -66}, {228, -66}, {235, -65}, {236, -65}, {240, -65}, {244, -65},
+    {248, -65}, {252, -65},
+    /* [256, 512) */
+    {256, -64}, {264, -64}, {279, -63}, {280, -63}, {288, -63}, {296, -63},
+    {304, -62}, {312, -62}, {320, -62}, {332, -61}, {336, -61}, {344, -61},
+    {352, -61}, {362, -60}, {368, -60}, {376, -60}, {384, -60}, {395, -59},
+    {400, -59}, {408, -59}, {416, -59}, {431, -58}, {432, -58}, {440, -58},
+    {448, -58}, {456, -58}, {470, -57}, {472, -57}, {480, -57}, {488, -57},
+    {496, -57}, {504, -57},
+    /* [512, 1024) */
+    {512, -56}, {528, -56}, {558, -55}, {560, -55}, {576, -55}, {592, -55},
+    {609, -54}, {624, -54}, {640, -54}, {664, -53}, {672, -53}, {688, -53},
+    {704, -53}, {724, -52}, {736, -52}, {752, -52}, {768, -52}, {790, -51},
+    {800, -51}, {816, -51}, {832, -51}, {861, -50}, {864, -50}, {880, -50},
+    {896, -50}, {912, -50}, {939, -49}, {944, -49}, {960, -49}, {976, -49},
+    {992, -49}, {1008, -49},
+    /* [1024, 2048) */
+    {1024, -48}, {1056, -48}, {1117, -47}, {1120, -47}, {1152, -47},
+    {1184, -47}, {1218, -46}, {1248, -46}, {1280, -46}, {1328, -45},
+    {1344, -45}, {1376, -45}, {1408, -45}, {1448, -44}, {1472, -44},
+    {1504, -44}, {1536, -44}, {1579, -43}, {1600, -43}, {1632, -43},
+    {1664, -43}, {1722, -42}, {1728, -42}, {1760, -42}, {1792, -42},
+    {1824, -42}, {1878, -41}, {1888, -41}, {1920, -41}, {1952, -41},
+    {1984, -41}, {2016, -41},
+    /* [2048, 4096) */
+    {2048, -40}, {2112, -40}, {2233, -39}, {2240, -39}, {2304, -39},
+    {2368, -39}, {2435, -38}, {2496, -38}, {2560, -38}, {2656, -37},
+    {2688, -37}, {2752, -37}, {2816, -37}, {2896, -36}, {2944, -36},
+    {3008, -36}, {3072, -36}, {3158, -35}, {3200, -35}, {3264, -35},
+    {3328, -35}, {3444, -34}, {3456, -34}, {3520, -34}, {3584, -34},
+    {3648, -34}, {3756, -33}, {3776, -33}, {3840, -33}, {3904, -33},
+    {3968, -33}, {4032, -33},
+    /* [4096, 8192) */
+    {4096, -32}, {4224, -32}, {4467, -31}, {4480, -31}, {4608, -31},
+    {4736, -31}, {4871, -30}, {4992, -30}, {5120, -30}, {5312, -29},
+    {5376, -29}, {5504, -29}, {5632, -29}, {5793, -28}, {5888, -28},
+    {6016, -28}, {6144, -28}, {6317, -27}, {6400, -27}, {6528, -27},
+    {6656, -27}, {6889, -26}, {6912, -26}, {7040, -26}, {7168, -26},
+    {7296, -26}, {7512, -25}, {7552, -25}, {7680, -25}, {7808, -25},
+    {7936, -25}, {8064, -25},
+    /* [8192, 16384) */
+    {8192, -24}, {8448, -24}, {8933, -23}, {8960, -23}, {9216, -23},
+    {9472, -23}, {9742, -22}, {9984, -22}, {10240, -22}, {10624, -21},
+    {10752, -21}, {11008, -21}, {11264, -21}, {11585, -20}, {11776, -20},
+    {12032, -20}, {12288, -20}, {12634, -19}, {12800, -19}, {13056, -19},
+    {13312, -19}, {13777, -18}, {13824, -18}, {14080, -18}, {14336, -18},
+    {14592, -18}, {15024, -17}, {15104, -17}, {15360, -17}, {15616, -17},
+    {15872, -17}, {16128, -17},
+    /* [16384, 32768) */
+    {16384, -16}, {16896, -16}, {17867, -15}, {17920, -15}, {18432, -15},
+    {18944, -15}, {19484, -14}, {19968, -14}, {20480, -14}, {21247, -13},
+    {21504, -13}, {22016, -13}, {22528, -13}, {23170, -12}, {23552, -12},
+    {24064, -12}, {24576, -12}, {25268, -11}, {25600, -11}, {26112, -11},
+    {26624, -11}, {27554, -10}, {27648, -10}, {28160, -10}, {28672, -10},
+    {29184, -10}, {30048, -9}, {30208, -9}, {30720, -9}, {31232, -9},
+    {31744, -9}, {32256, -9},
+    /* [32768, 65536) */
+    {32768, -8}, {33792, -8}, {35734, -7}, {35840, -7}, {36864, -7},
+    {37888, -7}, {38968, -6}, {39936, -6}, {40960, -6}, {42495, -5},
+    {43008, -5}, {44032, -5}, {45056, -5}, {46341, -4}, {47104, -4},
+    {48128, -4}, {49152, -4}, {50535, -3}, {51200, -3}, {52224, -3},
+    {53248, -3}, {55109, -2}, {55296, -2}, {56320, -2}, {57344, -2},
+    {58368, -2}, {60097, -1}, {60416, -1}, {61440, -1}, {62464, -1},
+    {63488, -1}, {64512, -1},
+};
+
+static inline int log2_clz32(uint32_t x)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_clz(x);
+#else
+    int n = 0;
+    while (!(x & 0x80000000u)) {
+        x <<= 1;
+        n++;
+    }
+    return n;
+#endif
+}
+
 /* store precalculated function (log2(arg << 24)) << 3 */
 static inline int log2_lshift16(uint64_t lshift16)
 {
-    if (lshift16 < 558) {
-        if (lshift16 < 54) {
-            if (lshift16 < 13) {
-                if (lshift16 < 7) {
-                    if (lshift16 < 1)
-                        return -136;
-                    if (lshift16 < 2)
-                        return -123;
-                    if (lshift16 < 3)
-                        return -117;
-                    if (lshift16 < 4)
-                        return -113;
-                    if (lshift16 < 5)
-                        return -110;
-                    if (lshift16 < 6)
-                        return -108;
-                    if (lshift16 < 7)
-                        return -106;
-                } else {
-                    if (lshift16 < 8)
-                        return -104;
-                    if (lshift16 < 9)
-                        return -103;
-                    if (lshift16 < 10)
-                        return -102;
-                    if (lshift16 < 11)
-                        return -100;
-                    if (lshift16 < 12)
-                        return -99;
-                    if (lshift16 < 13)
-                        return -98;
-                }
-            } else {
-                if (lshift16 < 29) {
-                    if (lshift16 < 15)
-                        return -97;
-                    if (lshift16 < 16)
-                        return -96;
-                    if (lshift16 < 17)
-                        return -95;
-                    if (lshift16 < 19)
-                        return -94;
-                    if (lshift16 < 21)
-                        return -93;
-                    if (lshift16 < 23)
-                        return -92;
-                    if (lshift16 < 25)
-                        return -91;
-                    if (lshift16 < 27)
-                        return -90;
-                    if (lshift16 < 29)
-                        return -89;
-                } else {
-                    if (lshift16 < 32)
-                        return -88;
-                    if (lshift16 < 35)
-                        return -87;
-                    if (lshift16 < 38)
-                        return -86;
-                    if (lshift16 < 41)
-                        return -85;
-                    if (lshift16 < 45)
-                        return -84;
-                    if (lshift16 < 49)
-                        return -83;
-                    if (lshift16 < 54)
-                        return -82;
-                }
-            }
-        } else {
-            if (lshift16 < 181) {
-                if (lshift16 < 99) {
-                    if (lshift16 < 59)
-                        return -81;
-                    if (lshift16 < 64)
-                        return -80;
-                    if (lshift16 < 70)
-                        return -79;
-                    if (lshift16 < 76)
-                        return -78;
-                    if (lshift16 < 83)
-                        return -77;
-                    if (lshift16 < 91)
-                        return -76;
-                    if (lshift16 < 99)
-                        return -75;
-                } else {
-                    if (lshift16 < 108)
-                        return -74;
-                    if (lshift16 < 117)
-                        return -73;
-                    if (lshift16 < 128)
-                        return -72;
-                    if (lshift16 < 140)
-                        return -71;
-                    if (lshift16 < 152)
-                        return -70;
-                    if (lshift16 < 166)
-                        return -69;
-                    if (lshift16 < 181)
-                        return -68;
-                }
-            } else {
-                if (lshift16 < 304) {
-                    if (lshift16 < 197)
-                        return -67;
-                    if (lshift16 < 215)
-                        return -66;
-                    if (lshift16 < 235)
-                        return -65;
-                    if (lshift16 < 256)
-                        return -64;
-                    if (lshift16 < 279)
-                        return -63;
-                    if (lshift16 < 304)
-                        return -62;
-                } else {
-                    if (lshift16 < 332)
-                        return -61;
-                    if (lshift16 < 362)
-                        return -60;
-                    if (lshift16 < 395)
-                        return -59;
-                    if (lshift16 < 431)
-                        return -58;
-                    if (lshift16 < 470)
-                        return -57;
-                    if (lshift16 < 512)
-                        return -56;
-                    if (lshift16 < 558)
-                        return -55;
-                }
-            }
-        }
-    } else {
-        if (lshift16 < 6317) {
-            if (lshift16 < 2048) {
-                if (lshift16 < 1117) {
-                    if (lshift16 < 609)
-                        return -54;
-                    if (lshift16 < 664)
-                        return -53;
-                    if (lshift16 < 724)
-                        return -52;
-                    if (lshift16 < 790)
-                        return -51;
-                    if (lshift16 < 861)
-                        return -50;
-                    if (lshift16 < 939)
-                        return -49;
-                    if (lshift16 < 1024)
-                        return -48;
-                    if (lshift16 < 1117)
-                        return -47;
-                } else {
-                    if (lshift16 < 1218)
-                        return -46;
-                    if (lshift16 < 1328)
-                        return -45;
-                    if (lshift16 < 1448)
-                        return -44;
-                    if (lshift16 < 1579)
-                        return -43;
-                    if (lshift16 < 1722)
-                        return -42;
-                    if (lshift16 < 1878)
-                        return -41;
-                    if (lshift16 < 2048)
-                        return -40;
-                }
-            } else {
-                if (lshift16 < 3756) {
-                    if (lshift16 < 2233)
-                        return -39;
-                    if (lshift16 < 2435)
-                        return -38;
-                    if (lshift16 < 2656)
-                        return -37;
-                    if (lshift16 < 2896)
-                        return -36;
-                    if (lshift16 < 3158)
-                        return -35;
-                    if (lshift16 < 3444)
-                        return -34;
-                    if (lshift16 < 3756)
-                        return -33;
-                } else {
-                    if (lshift16 < 4096)
-                        return -32;
-                    if (lshift16 < 4467)
-                        return -31;
-                    if (lshift16 < 4871)
-                        return -30;
-                    if (lshift16 < 5312)
-                        return -29;
-                    if (lshift16 < 5793)
-                        return -28;
-                    if (lshift16 < 6317)
-                        return -27;
-                }
-            }
-        } else {
-            if (lshift16 < 21247) {
-                if (lshift16 < 11585) {
-                    if (lshift16 < 6889)
-                        return -26;
-                    if (lshift16 < 7512)
-                        return -25;
-                    if (lshift16 < 8192)
-                        return -24;
-                    if (lshift16 < 8933)
-                        return -23;
-                    if (lshift16 < 9742)
-                        return -22;
-                    if (lshift16 < 10624)
-                        return -21;
-                    if (lshift16 < 11585)
-                        return -20;
-                } else {
-                    if (lshift16 < 12634)
-                        return -19;
-                    if (lshift16 < 13777)
-                        return -18;
-                    if (lshift16 < 15024)
-                        return -17;
-                    if (lshift16 < 16384)
-                        return -16;
-                    if (lshift16 < 17867)
-                        return -15;
-                    if (lshift16 < 19484)
-                        return -14;
-                    if (lshift16 < 21247)
-                        return -13;
-                }
-            } else {
-                if (lshift16 < 35734) {
-                    if (lshift16 < 23170)
-                        return -12;
-                    if (lshift16 < 25268)
-                        return -11;
-                    if (lshift16 < 27554)
-                        return -10;
-                    if (lshift16 < 30048)
-                        return -9;
-                    if (lshift16 < 32768)
-                        return -8;
-                    if (lshift16 < 35734)
-                        return -7;
-                } else {
-                    if (lshift16 < 38968)
-                        return -6;
-                    if (lshift16 < 42495)
-                        return -5;
-                    if (lshift16 < 46341)
-                        return -4;
-                    if (lshift16 < 50535)
-                        return -3;
-                    if (lshift16 < 55109)
-                        return -2;
-                    if (lshift16 < 60097)
-                        return -1;
-                }
-            }
-        }
-    }
-    return 0;
+    if (lshift16 >= LOG2_ARG_SHIFT)
+        return 0;
+    if (!lshift16)
+        return -136;
+
+    /* With the argument moved to the top half, the leading one is at bit
+     * 16 + e and there are always five bits below it to pick the slot.
+     */
+    uint32_t x = (uint32_t) lshift16 << 16;
+    int lead = 31 - log2_clz32(x);
+    const struct log2_slot *slot =
+        &log2_slots[(lead - 16) * 32 + ((x >> (lead - 5)) & 31)];
+    return slot->base + (lshift16 >= slot->threshold);
 }
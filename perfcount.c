@@ -0,0 +1,192 @@
+/* Hardware event counters through perf_event_open(2) */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "perfcount.h"
+
+static const char *event_names[PERFCOUNT_EVENTS] = {
+    [PERFCOUNT_CYCLES] = "cycles",
+    [PERFCOUNT_INSTRUCTIONS] = "instructions",
+    [PERFCOUNT_L1D_MISSES] = "L1d misses",
+    [PERFCOUNT_LLC_MISSES] = "LLC misses",
+    [PERFCOUNT_BRANCH_MISSES] = "branch misses",
+};
+
+void perfcount_add(perfcount_t *sum, const perfcount_t *c)
+{
+    for (int i = 0; i < PERFCOUNT_EVENTS; i++) {
+        if (!c->valid[i])
+            continue;
+        sum->value[i] += c->value[i];
+        sum->runs[i] += c->runs[i];
+        sum->valid[i] = true;
+    }
+}
+
+/* Count of event @i per region */
+static double per_run(const perfcount_t *c, int i)
+{
+    return (double) c->value[i] / c->runs[i];
+}
+
+char *perfcount_format(char *buf, size_t size, const perfcount_t *c)
+{
+    size_t len = 0;
+    buf[0] = '\0';
+    for (int i = 0; i < PERFCOUNT_EVENTS && len < size; i++) {
+        const char *sep = i ? ", " : "";
+        if (!c->valid[i]) {
+            len += snprintf(buf + len, size - len, "%s%s n/a", sep,
+                            event_names[i]);
+            continue;
+        }
+        len += snprintf(buf + len, size - len, "%s%s %.0f", sep,
+                        event_names[i], per_run(c, i));
+        if (i == PERFCOUNT_INSTRUCTIONS && c->valid[PERFCOUNT_CYCLES] &&
+            c->value[PERFCOUNT_CYCLES] && len < size)
+            len += snprintf(buf + len, size - len, " (IPC %.2f)",
+                            per_run(c, PERFCOUNT_INSTRUCTIONS) /
+                                per_run(c, PERFCOUNT_CYCLES));
+    }
+    return buf;
+}
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define CACHE_READ_MISS(cache)                                         \
+    ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) |                    \
+     (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static const struct {
+    uint32_t type;
+    uint64_t config;
+} events[PERFCOUNT_EVENTS] = {
+    [PERFCOUNT_CYCLES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    [PERFCOUNT_INSTRUCTIONS] = {PERF_TYPE_HARDWARE,
+                                PERF_COUNT_HW_INSTRUCTIONS},
+    [PERFCOUNT_L1D_MISSES] = {PERF_TYPE_HW_CACHE,
+                              CACHE_READ_MISS(PERF_COUNT_HW_CACHE_L1D)},
+    [PERFCOUNT_LLC_MISSES] = {PERF_TYPE_HW_CACHE,
+                              CACHE_READ_MISS(PERF_COUNT_HW_CACHE_LL)},
+    [PERFCOUNT_BRANCH_MISSES] = {PERF_TYPE_HARDWARE,
+                                 PERF_COUNT_HW_BRANCH_MISSES},
+};
+
+static int leader_fd = -1;
+static int fds[PERFCOUNT_EVENTS];
+static int n_open;
+static int slot[PERFCOUNT_EVENTS]; /* Position in a group read, or -1 */
+
+/* Layout of a read(2) of the group leader */
+typedef struct {
+    uint64_t nr;
+    uint64_t time_enabled;
+    uint64_t time_running;
+    uint64_t values[PERFCOUNT_EVENTS];
+} group_read_t;
+
+static group_read_t start;
+
+bool perfcount_open(void)
+{
+    if (leader_fd >= 0)
+        return true;
+
+    int err = 0;
+    n_open = 0;
+    for (int i = 0; i < PERFCOUNT_EVENTS; i++) {
+        struct perf_event_attr attr = {
+            .type = events[i].type,
+            .size = sizeof(attr),
+            .config = events[i].config,
+            .read_format = PERF_FORMAT_GROUP |
+                           PERF_FORMAT_TOTAL_TIME_ENABLED |
+                           PERF_FORMAT_TOTAL_TIME_RUNNING,
+            .exclude_kernel = 1,
+            .exclude_hv = 1,
+        };
+        int fd = syscall(SYS_perf_event_open, &attr, 0, -1, leader_fd, 0);
+        if (fd < 0) {
+            err = errno;
+            slot[i] = -1;
+            continue;
+        }
+        if (leader_fd < 0)
+            leader_fd = fd;
+        fds[n_open] = fd;
+        slot[i] = n_open++;
+    }
+
+    if (leader_fd < 0) {
+        errno = err;
+        return false;
+    }
+    return true;
+}
+
+void perfcount_close(void)
+{
+    for (int i = 0; i < n_open; i++)
+        close(fds[i]);
+    n_open = 0;
+    leader_fd = -1;
+}
+
+static bool read_group(group_read_t *g)
+{
+    size_t bytes = (3 + n_open) * sizeof(uint64_t);
+    return leader_fd >= 0 && read(leader_fd, g, bytes) == (ssize_t) bytes;
+}
+
+void perfcount_start(void)
+{
+    if (!read_group(&start))
+        start.nr = 0;
+}
+
+void perfcount_stop(perfcount_t *c)
+{
+    group_read_t end;
+    bool ok = start.nr && read_group(&end);
+
+    /* While the group was not on the PMU, the counts are extrapolated */
+    uint64_t enabled = ok ? end.time_enabled - start.time_enabled : 0;
+    uint64_t running = ok ? end.time_running - start.time_running : 0;
+    for (int i = 0; i < PERFCOUNT_EVENTS; i++) {
+        c->valid[i] = ok && slot[i] >= 0 && running;
+        c->runs[i] = c->valid[i];
+        c->value[i] = 0;
+        if (!c->valid[i])
+            continue;
+        uint64_t delta = end.values[slot[i]] - start.values[slot[i]];
+        c->value[i] = running == enabled
+                          ? delta
+                          : (uint64_t) ((double) delta * enabled / running);
+    }
+}
+
+#else
+
+bool perfcount_open(void)
+{
+    errno = ENOSYS;
+    return false;
+}
+
+void perfcount_close(void) {}
+
+void perfcount_start(void) {}
+
+void perfcount_stop(perfcount_t *c)
+{
+    memset(c, 0, sizeof(*c));
+}
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef LAB0_PERFCOUNT_H
+#define LAB0_PERFCOUNT_H
+
+/* Hardware event counters of the calling thread
+ *
+ * Cycles, instructions, L1 data and last-level cache read misses and branch
+ * misses are counted through perf_event_open(2) in a single group, so that
+ * one read(2) returns all of them. Events the CPU or the kernel do not offer,
+ * as in many containers and virtual machines, are left out and reported as
+ * unavailable rather than failing the others.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+enum {
+    PERFCOUNT_CYCLES,
+    PERFCOUNT_INSTRUCTIONS,
+    PERFCOUNT_L1D_MISSES,
+    PERFCOUNT_LLC_MISSES,
+    PERFCOUNT_BRANCH_MISSES,
+    PERFCOUNT_EVENTS,
+};
+
+/**
+ * perfcount_t - Event counts over a measured region
+ * @value: count of each event, scaled up if the kernel multiplexed the group
+ * @valid: whether each event is counted at all
+ * @runs: number of regions @value sums for each event, see perfcount_add()
+ */
+typedef struct {
+    uint64_t value[PERFCOUNT_EVENTS];
+    bool valid[PERFCOUNT_EVENTS];
+    uint32_t runs[PERFCOUNT_EVENTS];
+} perfcount_t;
+
+/**
+ * perfcount_open() - Open the counters, no effect if already open
+ *
+ * Return: false when no event at all can be counted, e.g. outside Linux or
+ * when perf_event_paranoid forbids it, with errno telling why
+ */
+bool perfcount_open(void);
+
+/**
+ * perfcount_close() - Release the counters, no effect if not opened
+ */
+void perfcount_close(void);
+
+/**
+ * perfcount_start() - Begin a measured region
+ */
+void perfcount_start(void);
+
+/**
+ * perfcount_stop() - End the region begun by the last perfcount_start()
+ * @c: where to store the counts of the region
+ */
+void perfcount_stop(perfcount_t *c);
+
+/**
+ * perfcount_add() - Accumulate the counts of a region
+ * @sum: accumulated counts, zero-initialized before the first region
+ * @c: counts of one region
+ *
+ * Events @c did not count are left out of @sum instead of adding zero, so an
+ * event stays valid in @sum as long as one region counted it.
+ */
+void perfcount_add(perfcount_t *sum, const perfcount_t *c);
+
+/**
+ * perfcount_format() - Describe counts in a line of text
+ * @buf: buffer for the text
+ * @size: size of @buf
+ * @c: counts to describe, shown per region counted
+ *
+ * Return: @buf
+ */
+char *perfcount_format(char *buf, size_t size, const perfcount_t *c);
+
+#endif /* LAB0_PERFCOUNT_H */
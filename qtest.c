@@ -2,14 +2,20 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <math.h>
 #include <signal.h>
 #include <spawn.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h> /* strcasecmp */
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
@@ -19,12 +25,17 @@
 #include <time.h>
 #endif
 
+#include "cqueue.h"
+#include "dudect/cpucycles.h"
 #include "dudect/fixture.h"
 #include "list.h"
 #include "random.h"
 
 /* Shannon entropy */
 extern double shannon_entropy(const uint8_t *input_data);
+extern void shannon_entropy_batch(const uint8_t *const *strs,
+                                  size_t n,
+                                  double *out);
 extern int show_entropy;
 
 /* Our program needs to use regular malloc/free */
@@ -75,9 +86,13 @@ static int string_length = MAXSTRING;
 
 static int descend = 0;
 
+/* Seed of the random data, 0 for randomness from the operating system */
+static int data_seed = 0;
+
 #define MIN_RANDSTR_LEN 5
 #define MAX_RANDSTR_LEN 10
-static const char charset[] = "abcdefghijklmnopqrstuvwxyz";
+/* Random strings are generated this many at a time into one buffer */
+#define RANDSTR_BATCH 4096
 /* For queue_insert and queue_remove */
 typedef enum {
     POS_TAIL,
@@ -85,6 +100,7 @@ typedef enum {
 } position_t;
 /* Forward declarations */
 static bool q_show(int vlevel);
+uintptr_t os_random(uintptr_t seed);
 
 static bool do_free(int argc, char *argv[])
 {
@@ -163,45 +179,58 @@ static bool do_new(int argc, char *argv[])
     return ok && !error_check();
 }
 
-/* TODO: Add a buf_size check of if the buf_size may be less
- * than MIN_RANDSTR_LEN.
+/* Fill @buf with @n NUL-terminated random strings laid out back to back, each
+ * of length uniform in [MIN_RANDSTR_LEN, MAX_RANDSTR_LEN - 1]. All letters
+ * come from a single random_alpha() call over the whole buffer.
  */
-static void fill_rand_string(char *buf, size_t buf_size)
+static void fill_rand_strings(char *buf, size_t n)
 {
-    size_t len = 0;
-    while (len < MIN_RANDSTR_LEN)
-        len = rand() % buf_size;
+    uint16_t lens[RANDSTR_BATCH];
+    random_fill(lens, n * sizeof(uint16_t));
+
+    size_t total = 0;
+    for (size_t i = 0; i < n; i++) {
+        lens[i] = MIN_RANDSTR_LEN +
+                  (((uint32_t) lens[i] * (MAX_RANDSTR_LEN - MIN_RANDSTR_LEN)) >>
+                   16);
+        total += lens[i] + 1;
+    }
 
-    uint64_t randstr_buf_64[MAX_RANDSTR_LEN] = {0};
-    randombytes((uint8_t *) randstr_buf_64, len * sizeof(uint64_t));
-    for (size_t n = 0; n < len; n++)
-        buf[n] = charset[randstr_buf_64[n] % (sizeof(charset) - 1)];
+    random_alpha(buf, total);
+    for (size_t i = 0, pos = 0; i < n; i++) {
+        pos += lens[i];
+        buf[pos++] = '\0';
+    }
+}
 
-    buf[len] = '\0';
+/* In simulation mode, commands run the dudect test of their operation */
+static bool simulate(int argc, char *argv[], bool (*is_const)(void))
+{
+    if (argc != 1) {
+        report(1, "%s does not need arguments in simulation mode", argv[0]);
+        return false;
+    }
+    if (!is_const()) {
+        report(1, "ERROR: Probably not constant time or wrong implementation");
+        return false;
+    }
+    report(1, "Probably constant time");
+    return true;
 }
 
 /* insertion */
 static bool queue_insert(position_t pos, int argc, char *argv[])
 {
-    if (simulation) {
-        if (argc != 1) {
-            report(1, "%s does not need arguments in simulation mode", argv[0]);
-            return false;
-        }
-        bool ok =
-            pos == POS_TAIL ? is_insert_tail_const() : is_insert_head_const();
-        if (!ok) {
-            report(1,
-                   "ERROR: Probably not constant time or wrong implementation");
-            return false;
-        }
-        report(1, "Probably constant time");
-        return ok;
-    }
+    if (simulation)
+        return simulate(argc, argv,
+                        pos == POS_TAIL ? is_insert_tail_const
+                                        : is_insert_head_const);
 
     char *lasts = NULL;
-    char randstr_buf[MAX_RANDSTR_LEN];
-    int reps = 1;
+    static char randstr_buf[RANDSTR_BATCH * MAX_RANDSTR_LEN];
+    char *randstr = NULL;
+    int reps = 1, randstr_left = 0, generated = 0;
+    double gen_time = 0;
     bool ok = true, need_rand = false;
     if (argc != 2 && argc != 3) {
         report(1, "%s needs 1-2 arguments", argv[0]);
@@ -216,10 +245,8 @@ static bool queue_insert(position_t pos, int argc, char *argv[])
         }
     }
 
-    if (!strcmp(inserts, "RAND")) {
+    if (!strcmp(inserts, "RAND"))
         need_rand = true;
-        inserts = randstr_buf;
-    }
 
     if (!current || !current->q)
         report(3, "Warning: Calling insert %s on null queue",
@@ -228,8 +255,21 @@ static bool queue_insert(position_t pos, int argc, char *argv[])
 
     if (current && exception_setup(true)) {
         for (int r = 0; ok && r < reps; r++) {
-            if (need_rand)
-                fill_rand_string(randstr_buf, sizeof(randstr_buf));
+            if (need_rand) {
+                if (!randstr_left) {
+                    double t;
+                    randstr_left = reps - r < RANDSTR_BATCH ? reps - r
+                                                            : RANDSTR_BATCH;
+                    init_time(&t);
+                    fill_rand_strings(randstr_buf, randstr_left);
+                    gen_time += delta_time(&t);
+                    generated += randstr_left;
+                    randstr = randstr_buf;
+                }
+                inserts = randstr;
+                randstr += strlen(randstr) + 1;
+                randstr_left--;
+            }
             bool rval = pos == POS_TAIL ? q_insert_tail(current->q, inserts)
                                         : q_insert_head(current->q, inserts);
             if (rval) {
@@ -272,6 +312,11 @@ static bool queue_insert(position_t pos, int argc, char *argv[])
     }
     exception_cancel();
 
+    /* The rate differs from run to run, keep it out of ordinary output */
+    if (generated >= RANDSTR_BATCH && gen_time > 0)
+        report(4, "Generated %d random strings, %.0f strings/sec", generated,
+               generated / gen_time);
+
     q_show(3);
     return ok;
 }
@@ -295,21 +340,10 @@ static bool queue_remove(position_t pos, int argc, char *argv[])
      * We shall figure out the exact reasons and resolve later.
      */
 #if !(defined(__aarch64__) && defined(__APPLE__))
-    if (simulation) {
-        if (argc != 1) {
-            report(1, "%s does not need arguments in simulation mode", argv[0]);
-            return false;
-        }
-        bool ok =
-            pos == POS_TAIL ? is_remove_tail_const() : is_remove_head_const();
-        if (!ok) {
-            report(1,
-                   "ERROR: Probably not constant time or wrong implementation");
-            return false;
-        }
-        report(1, "Probably constant time");
-        return ok;
-    }
+    if (simulation)
+        return simulate(argc, argv,
+                        pos == POS_TAIL ? is_remove_tail_const
+                                        : is_remove_head_const);
 #endif
 
     if (argc != 1 && argc != 2) {
@@ -533,8 +567,166 @@ static bool do_reverse(int argc, char *argv[])
     return !error_check();
 }
 
+/* Largest queue the uniformity check of shuffle runs on, 8! = 40320 bins */
+#define SHUFFLE_CHECK_MAX 8
+
+/* Shuffles run between two exception setups, well within the time limit */
+#define SHUFFLE_BATCH 65536
+
+/* Index in [0, n!) of the order of @head with respect to @orig, the order of
+ * the same nodes before shuffling, computed as its Lehmer code.
+ */
+static size_t perm_rank(struct list_head *const *orig,
+                        const struct list_head *head,
+                        size_t n)
+{
+    size_t pos[SHUFFLE_CHECK_MAX], k = 0;
+    const struct list_head *node;
+    list_for_each(node, head) {
+        size_t j = 0;
+        while (orig[j] != node)
+            j++;
+        pos[k++] = j;
+    }
+
+    size_t rank = 0;
+    for (size_t i = 0; i < n; i++) {
+        size_t smaller = 0;
+        for (size_t j = i + 1; j < n; j++)
+            smaller += pos[j] < pos[i];
+        rank = rank * (n - i) + smaller;
+    }
+    return rank;
+}
+
+/* Upper tail of the chi-square distribution with @df degrees of freedom,
+ * through the Wilson-Hilferty normal approximation.
+ */
+static double chi2_pvalue(double chi2, size_t df)
+{
+    double v = 2.0 / (9.0 * df);
+    double z = (cbrt(chi2 / df) - (1.0 - v)) / sqrt(v);
+    return 0.5 * erfc(z / sqrt(2.0));
+}
+
+/* Shuffle the current queue @trials times, count how often each of the n!
+ * orders comes out and run a chi-square test against the uniform distribution.
+ */
+static bool shuffle_check(int trials)
+{
+    size_t n = current->size;
+    if (n < 2 || n > SHUFFLE_CHECK_MAX) {
+        report(1, "Uniformity check needs a queue of 2 to %d elements",
+               SHUFFLE_CHECK_MAX);
+        return false;
+    }
+
+    size_t bins = 1;
+    for (size_t i = 2; i <= n; i++)
+        bins *= i;
+    if ((size_t) trials < 5 * bins) {
+        report(1, "Need at least %zu trials for %zu permutations", 5 * bins,
+               bins);
+        return false;
+    }
+
+    struct list_head *orig[SHUFFLE_CHECK_MAX], *node;
+    size_t k = 0;
+    list_for_each(node, current->q)
+        orig[k++] = node;
+
+    size_t *counts = calloc(bins, sizeof(size_t));
+    if (!counts) {
+        report(1, "ERROR: Could not allocate %zu counters", bins);
+        return false;
+    }
+
+    bool ok = true;
+    for (int done = 0; ok && done < trials; done += SHUFFLE_BATCH) {
+        int batch =
+            trials - done < SHUFFLE_BATCH ? trials - done : SHUFFLE_BATCH;
+        if (exception_setup(true)) {
+            for (int t = 0; ok && t < batch; t++) {
+                ok = q_shuffle(current->q);
+                counts[perm_rank(orig, current->q, n)]++;
+            }
+        } else {
+            ok = false;
+        }
+        exception_cancel();
+        ok = ok && !error_check();
+    }
+
+    if (!ok) {
+        free(counts);
+        report(1, "ERROR: Shuffle failed");
+        return false;
+    }
+
+    double expected = (double) trials / bins, chi2 = 0;
+    size_t min = SIZE_MAX, max = 0;
+    for (size_t i = 0; i < bins; i++) {
+        double d = counts[i] - expected;
+        chi2 += d * d / expected;
+        if (counts[i] < min)
+            min = counts[i];
+        if (counts[i] > max)
+            max = counts[i];
+    }
+    free(counts);
+
+    double p = chi2_pvalue(chi2, bins - 1);
+    report(1,
+           "%d shuffles over %zu permutations: expected %.1f each, got %zu to "
+           "%zu",
+           trials, bins, expected, min, max);
+    report(1, "Chi-square = %.2f, %zu degrees of freedom, p = %.4f", chi2,
+           bins - 1, p);
+    if (p < 0.001) {
+        report(1, "ERROR: Shuffle does not look uniform");
+        return false;
+    }
+    return true;
+}
+
+static bool do_shuffle(int argc, char *argv[])
+{
+    if (argc != 1 && argc != 2) {
+        report(1, "%s takes 0-1 arguments", argv[0]);
+        return false;
+    }
+
+    int trials = 0;
+    if (argc == 2 && (!get_int(argv[1], &trials) || trials < 1)) {
+        report(1, "Invalid number of trials '%s'", argv[1]);
+        return false;
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Calling shuffle on null queue");
+        return false;
+    }
+    error_check();
+
+    if (trials)
+        return shuffle_check(trials);
+
+    bool ok = false;
+    if (exception_setup(true))
+        ok = q_shuffle(current->q);
+    exception_cancel();
+
+    if (!ok)
+        report(1, "ERROR: Shuffle failed");
+    q_show(3);
+    return ok && !error_check();
+}
+
 static bool do_size(int argc, char *argv[])
 {
+    if (simulation)
+        return simulate(argc, argv, is_size_const);
+
     if (argc != 1 && argc != 2) {
         report(1, "%s takes 0-1 arguments", argv[0]);
         return false;
@@ -576,6 +768,203 @@ static bool do_size(int argc, char *argv[])
     return ok && !error_check();
 }
 
+/* Bytes taken by a malloc() of @size bytes with glibc on 64-bit hosts: the
+ * request plus an 8-byte header, rounded up to 16 bytes, 32 bytes at least.
+ */
+static size_t malloc_chunk(size_t size)
+{
+    size_t chunk = (size + 8 + 15) & ~(size_t) 15;
+    return chunk < 32 ? 32 : chunk;
+}
+
+static bool do_footprint(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Calling footprint on null queue");
+        return false;
+    }
+
+    /* What queue.c allocates, ignoring the block headers added by the test
+     * harness: the head, then one element_t and one string per element.
+     */
+    size_t list_bytes = malloc_chunk(sizeof(struct list_head));
+    cqueue_t *cq = cq_new();
+    bool ok = cq;
+    element_t *e;
+    list_for_each_entry(e, current->q, list) {
+        list_bytes += malloc_chunk(sizeof(element_t)) +
+                      malloc_chunk(strlen(e->value) + 1);
+        ok = ok && cq_insert_tail(cq, e->value);
+    }
+
+    if (!ok) {
+        report(1, "ERROR: Could not build compact copy of queue");
+        cq_free(cq);
+        return false;
+    }
+
+    size_t n = current->size, used;
+    size_t reserved = cq_footprint(cq, &used);
+    cq_free(cq);
+
+    report(1, "Elements: %zu", n);
+    if (!n) {
+        report(1, "list_head queue: %zu bytes, compact queue: %zu bytes",
+               list_bytes, reserved);
+        return true;
+    }
+    report(1, "list_head queue: %zu bytes, %.1f bytes/element", list_bytes,
+           (double) list_bytes / n);
+    report(1,
+           "Compact queue:   %zu bytes, %.1f bytes/element (%zu bytes, %.1f "
+           "bytes/element in use)",
+           reserved, (double) reserved / n, used, (double) used / n);
+    return true;
+}
+
+/* HyperLogLog with 2^14 one-byte registers, standard error about 0.8% */
+#define HLL_BITS 14
+#define HLL_REGS (1 << HLL_BITS)
+
+/* String lengths from this value up share the last histogram bucket */
+#define STATS_MAX_LEN 64
+
+typedef struct {
+    uint64_t bytes[4][256]; /* byte counts, by position modulo 4 */
+    uint64_t lens[STATS_MAX_LEN + 1];
+    uint8_t hll[HLL_REGS];
+    const char *min, *max;
+    size_t count;
+} stats_t;
+
+/* Scan @s once for its length, byte histogram and FNV-1a hash, then feed the
+ * hash to the HyperLogLog registers. Spreading the counts over four tables
+ * lets consecutive increments proceed without waiting on each other when the
+ * same byte repeats.
+ */
+static void stats_add(stats_t *st, const char *s)
+{
+    const uint8_t *p = (const uint8_t *) s;
+    uint64_t h = 0xcbf29ce484222325ULL;
+    size_t len = 0;
+
+    for (; p[len]; len++) {
+        st->bytes[len & 3][p[len]]++;
+        h = (h ^ p[len]) * 0x100000001b3ULL;
+    }
+    st->lens[len < STATS_MAX_LEN ? len : STATS_MAX_LEN]++;
+
+    /* FNV alone leaves the high bits poorly mixed; finish with fmix64 */
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+
+    uint64_t w = (h << HLL_BITS) | (1ULL << (HLL_BITS - 1));
+    uint8_t rank = __builtin_clzll(w) + 1;
+    if (rank > st->hll[h >> (64 - HLL_BITS)])
+        st->hll[h >> (64 - HLL_BITS)] = rank;
+
+    if (!st->min || strcmp(s, st->min) < 0)
+        st->min = s;
+    if (!st->max || strcmp(s, st->max) > 0)
+        st->max = s;
+    st->count++;
+}
+
+static double hll_estimate(const uint8_t *regs)
+{
+    const double m = HLL_REGS;
+    double sum = 0;
+    size_t zeros = 0;
+
+    for (size_t i = 0; i < HLL_REGS; i++) {
+        sum += ldexp(1.0, -regs[i]);
+        zeros += !regs[i];
+    }
+
+    double est = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+    /* Linear counting is more accurate while many registers are empty */
+    if (est <= 2.5 * m && zeros)
+        est = m * log(m / zeros);
+    return est;
+}
+
+static bool do_stats(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Calling stats on null queue");
+        return false;
+    }
+
+    stats_t *st = calloc(1, sizeof(stats_t));
+    if (!st) {
+        report(1, "ERROR: Could not allocate statistics");
+        return false;
+    }
+
+    bool ok = false;
+    error_check();
+    if (exception_setup(true)) {
+        element_t *e;
+        list_for_each_entry(e, current->q, list)
+            stats_add(st, e->value);
+        ok = true;
+    }
+    exception_cancel();
+
+    if (!ok || !st->count) {
+        if (ok)
+            report(1, "Queue is empty");
+        free(st);
+        return ok && !error_check();
+    }
+
+    uint64_t total = 0;
+    double entropy = 0;
+    for (int c = 0; c < 256; c++) {
+        uint64_t n =
+            st->bytes[0][c] + st->bytes[1][c] + st->bytes[2][c] + st->bytes[3][c];
+        st->bytes[0][c] = n;
+        total += n;
+    }
+    for (int c = 0; c < 256; c++) {
+        if (st->bytes[0][c]) {
+            double p = (double) st->bytes[0][c] / total;
+            entropy -= p * log2(p);
+        }
+    }
+
+    report(1, "Elements: %zu, bytes: %" PRIu64 ", mean length: %.2f",
+           st->count, total, (double) total / st->count);
+    report(1, "Byte entropy: %.3f bits/byte (%3.2f%%)", entropy,
+           entropy * 100.0 / 8);
+    report(1, "Distinct values: ~%.0f (HyperLogLog)", hll_estimate(st->hll));
+    report(1, "Min: %.*s", string_length, st->min);
+    report(1, "Max: %.*s", string_length, st->max);
+    report(1, "Lengths:");
+    for (int len = 0; len <= STATS_MAX_LEN; len++) {
+        if (st->lens[len])
+            report(1, "  %2d%s %10" PRIu64 " (%5.2f%%)", len,
+                   len == STATS_MAX_LEN ? "+" : " ", st->lens[len],
+                   st->lens[len] * 100.0 / st->count);
+    }
+
+    free(st);
+    return !error_check();
+}
+
 bool do_sort(int argc, char *argv[])
 {
     if (argc != 1) {
@@ -604,7 +993,7 @@ bool do_sort(int argc, char *argv[])
     unsigned no = 0;
     if (current && current->size && current->size <= MAX_NODES) {
         element_t *entry;
-        list_for_each_entry(entry, current->q, list)
+        list_for_each_entry_prefetch(entry, current->q, list)
             nodes[no++] = &entry->list;
     } else if (current && current->size > MAX_NODES)
         report(1,
@@ -669,6 +1058,9 @@ bool do_sort(int argc, char *argv[])
 
 static bool do_dm(int argc, char *argv[])
 {
+    if (simulation)
+        return simulate(argc, argv, is_delete_mid_const);
+
     if (argc != 1) {
         report(1, "%s takes no arguments", argv[0]);
         return false;
@@ -937,6 +1329,30 @@ static bool is_circular()
     return true;
 }
 
+/* Elements handed to shannon_entropy_batch() at a time */
+#define ENTROPY_BATCH 256
+
+/* Mean entropy of all the strings in the current queue */
+static double queue_entropy(void)
+{
+    const uint8_t *strs[ENTROPY_BATCH];
+    double ent[ENTROPY_BATCH], sum = 0;
+    size_t n = 0, total = 0;
+    element_t *e;
+
+    list_for_each_entry(e, current->q, list) {
+        strs[n++] = (const uint8_t *) e->value;
+        if (n == ENTROPY_BATCH || e->list.next == current->q) {
+            shannon_entropy_batch(strs, n, ent);
+            for (size_t i = 0; i < n; i++)
+                sum += ent[i];
+            total += n;
+            n = 0;
+        }
+    }
+    return total ? sum / total : 0;
+}
+
 static bool q_show(int vlevel)
 {
     bool ok = true;
@@ -958,6 +1374,8 @@ static bool q_show(int vlevel)
 
     struct list_head *ori = current->q;
     struct list_head *cur = current->q->next;
+    struct list_head *ahead =
+        list_prefetch_ahead(cur, ori, LIST_PREFETCH_DISTANCE);
 
     if (exception_setup(true)) {
         while (ok && ori != cur && cnt < current->size) {
@@ -972,6 +1390,7 @@ static bool q_show(int vlevel)
             }
             cnt++;
             cur = cur->next;
+            ahead = list_prefetch_advance(ahead, ori);
             ok = ok && !error_check();
         }
     }
@@ -987,6 +1406,18 @@ static bool q_show(int vlevel)
             report(vlevel, "]");
         else
             report(vlevel, " ... ]");
+        if (show_entropy && cnt > BIG_LIST_SIZE) {
+            bool computed = false;
+            double mean = 0;
+            if (exception_setup(true)) {
+                mean = queue_entropy();
+                computed = true;
+            }
+            exception_cancel();
+            if (computed)
+                report(vlevel, "Mean entropy of %d elements: %3.2f%%", cnt,
+                       mean);
+        }
     } else {
         report(vlevel, " ... ]");
         report(vlevel, "ERROR:  Queue has more than %d elements",
@@ -1056,6 +1487,461 @@ static bool do_next(int argc, char *argv[])
     return q_show(0);
 }
 
+/* Copy of the values of every queue, kept by "bench -r" */
+static struct {
+    char *values; /* Values of all queues, null-terminated, back to back */
+    int *sizes;   /* Number of values of each queue, in chain order */
+    int n_queues;
+    int current; /* Position of current in the chain */
+} snapshot;
+
+static bool snapshot_save(void)
+{
+    size_t bytes = 0;
+    int n = 0, pos = 0;
+    queue_contex_t *ctx;
+    list_for_each_entry(ctx, &chain.head, chain) {
+        element_t *e;
+        if (ctx->q)
+            list_for_each_entry(e, ctx->q, list)
+                bytes += strlen(e->value) + 1;
+        if (ctx == current)
+            pos = n;
+        n++;
+    }
+
+    snapshot.values = malloc(bytes ? bytes : 1);
+    snapshot.sizes = malloc((n ? n : 1) * sizeof(int));
+    if (!snapshot.values || !snapshot.sizes) {
+        report(1, "Couldn't allocate a copy of the queues");
+        free(snapshot.values);
+        free(snapshot.sizes);
+        return false;
+    }
+
+    char *dst = snapshot.values;
+    int *size = snapshot.sizes;
+    list_for_each_entry(ctx, &chain.head, chain) {
+        element_t *e;
+        *size = 0;
+        if (ctx->q) {
+            list_for_each_entry(e, ctx->q, list) {
+                size_t len = strlen(e->value) + 1;
+                memcpy(dst, e->value, len);
+                dst += len;
+                (*size)++;
+            }
+        }
+        size++;
+    }
+    snapshot.n_queues = n;
+    snapshot.current = pos;
+    return true;
+}
+
+/* Refill the queues with the values saved, through the queue implementation
+ * itself, with allocation failures held off
+ */
+static bool snapshot_restore(void)
+{
+    if (chain.size != snapshot.n_queues) {
+        report(1, "Cannot restore queues: %d queues instead of %d", chain.size,
+               snapshot.n_queues);
+        return false;
+    }
+
+    int saved_fail_probability = fail_probability;
+    fail_probability = 0;
+    set_cautious_mode(false);
+
+    bool ok = true;
+    if (exception_setup(true)) {
+        const char *src = snapshot.values;
+        int i = 0;
+        queue_contex_t *ctx;
+        list_for_each_entry(ctx, &chain.head, chain) {
+            if (i == snapshot.current)
+                current = ctx;
+            if (!ctx->q) {
+                i++;
+                continue;
+            }
+            element_t *e, *safe;
+            list_for_each_entry_safe(e, safe, ctx->q, list) {
+                list_del(&e->list);
+                q_release_element(e);
+            }
+            for (int k = 0; k < snapshot.sizes[i] && ok; k++) {
+                ok = q_insert_tail(ctx->q, (char *) src);
+                src += strlen(src) + 1;
+            }
+            ctx->size = snapshot.sizes[i++];
+        }
+    }
+    exception_cancel();
+
+    set_cautious_mode(true);
+    fail_probability = saved_fail_probability;
+    if (!ok)
+        report(1, "Cannot restore queues: insertion failed");
+    return ok && !error_check();
+}
+
+static bool snapshot_discard(void)
+{
+    free(snapshot.values);
+    free(snapshot.sizes);
+    snapshot.values = NULL;
+    snapshot.sizes = NULL;
+    return true;
+}
+
+/* File written by "save" and read back by "load", in host byte order:
+ *   header:    magic, version, number of queues, position of current
+ *   per queue: id, number of values
+ *   per value: length as a uint32_t, then the string and its null byte
+ * Keeping the null byte lets "load" insert values straight from the mapped
+ * file, without copying them out first.
+ */
+#define SAVE_MAGIC 0x504e5351 /* "QSNP" on little-endian hosts */
+#define SAVE_VERSION 1
+#define SAVE_HEADER_WORDS 4
+#define SAVE_QUEUE_WORDS 2
+
+/* iovecs gathered per writev() call, the IOV_MAX of Linux */
+#define SAVE_IOV 1024
+/* Headers and values up to SAVE_COPY_MAX bytes are copied into a buffer, so
+ * that millions of short strings do not cost an iovec each. Longer values are
+ * written from the queue directly.
+ */
+#define SAVE_BUF 65536
+#define SAVE_COPY_MAX 256
+
+typedef struct {
+    int fd;
+    struct iovec iov[SAVE_IOV];
+    int n_iov;
+    char buf[SAVE_BUF];
+    size_t used, mark; /* buf[mark..used) is not referenced by iov yet */
+} save_writer_t;
+
+static void save_close_segment(save_writer_t *w)
+{
+    if (w->used == w->mark)
+        return;
+    w->iov[w->n_iov++] = (struct iovec){
+        .iov_base = w->buf + w->mark,
+        .iov_len = w->used - w->mark,
+    };
+    w->mark = w->used;
+}
+
+static bool save_flush(save_writer_t *w)
+{
+    save_close_segment(w);
+
+    struct iovec *iov = w->iov;
+    int cnt = w->n_iov;
+    while (cnt) {
+        ssize_t n = writev(w->fd, iov, cnt);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        /* Skip what a short write did store */
+        while (cnt && (size_t) n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            cnt--;
+        }
+        if (cnt) {
+            iov->iov_base = (char *) iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    w->n_iov = 0;
+    w->used = w->mark = 0;
+    return true;
+}
+
+static bool save_add(save_writer_t *w, const void *data, size_t len)
+{
+    if (len <= SAVE_COPY_MAX) {
+        if (w->used + len > SAVE_BUF && !save_flush(w))
+            return false;
+        memcpy(w->buf + w->used, data, len);
+        w->used += len;
+        return true;
+    }
+
+    /* Room for the pending buffer segment and for @data */
+    if (w->n_iov + 2 > SAVE_IOV && !save_flush(w))
+        return false;
+    save_close_segment(w);
+    w->iov[w->n_iov++] = (struct iovec){
+        .iov_base = (void *) data,
+        .iov_len = len,
+    };
+    return true;
+}
+
+static bool do_save(int argc, char *argv[])
+{
+    if (argc != 2) {
+        report(1, "%s needs a file name", argv[0]);
+        return false;
+    }
+
+    /* Too large for the stack; a failed save may have left it part full */
+    static save_writer_t w;
+    w.n_iov = 0;
+    w.used = w.mark = 0;
+    w.fd = open(argv[1], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (w.fd < 0) {
+        report(1, "Cannot open '%s': %s", argv[1], strerror(errno));
+        return false;
+    }
+
+    double t;
+    init_time(&t);
+
+    uint32_t pos = 0, n = 0;
+    long values = 0;
+    queue_contex_t *ctx;
+    list_for_each_entry(ctx, &chain.head, chain) {
+        if (ctx == current)
+            pos = n;
+        n++;
+    }
+
+    uint32_t header[SAVE_HEADER_WORDS] = {SAVE_MAGIC, SAVE_VERSION, n, pos};
+    bool ok = save_add(&w, header, sizeof(header));
+    list_for_each_entry(ctx, &chain.head, chain) {
+        if (!ok)
+            break;
+        uint32_t size = 0;
+        struct list_head *node;
+        if (ctx->q)
+            list_for_each(node, ctx->q)
+                size++;
+        uint32_t words[SAVE_QUEUE_WORDS] = {ctx->id, size};
+        ok = save_add(&w, words, sizeof(words));
+
+        element_t *e;
+        if (ctx->q && ok) {
+            list_for_each_entry(e, ctx->q, list) {
+                uint32_t len = strlen(e->value);
+                ok = save_add(&w, &len, sizeof(len)) &&
+                     save_add(&w, e->value, len + 1);
+                if (!ok)
+                    break;
+            }
+            values += size;
+        }
+    }
+    ok = ok && save_flush(&w);
+    if (!ok)
+        report(1, "Cannot write '%s': %s", argv[1], strerror(errno));
+    if (close(w.fd) && ok) {
+        report(1, "Cannot write '%s': %s", argv[1], strerror(errno));
+        ok = false;
+    }
+
+    if (ok)
+        report(4, "Saved %ld values of %u queues in %.3f s", values, n,
+               delta_time(&t));
+    return ok;
+}
+
+static inline uint32_t load_word(const char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+/* Check the whole of the @len bytes at @map before anything is built, so that
+ * a truncated or foreign file leaves the queues untouched
+ */
+static bool load_check(const char *map, size_t len, const char *name)
+{
+    const char *end = map + len, *p = map;
+    if (len < SAVE_HEADER_WORDS * sizeof(uint32_t) ||
+        load_word(p) != SAVE_MAGIC || load_word(p + 4) != SAVE_VERSION) {
+        report(1, "'%s' is not a file written by save", name);
+        return false;
+    }
+
+    uint32_t n = load_word(p + 8), pos = load_word(p + 12);
+    if (n > INT_MAX || (n && pos >= n))
+        goto corrupt;
+    p += SAVE_HEADER_WORDS * sizeof(uint32_t);
+
+    for (uint32_t i = 0; i < n; i++) {
+        if ((size_t) (end - p) < SAVE_QUEUE_WORDS * sizeof(uint32_t))
+            goto corrupt;
+        uint32_t size = load_word(p + 4);
+        if (size > INT_MAX)
+            goto corrupt;
+        p += SAVE_QUEUE_WORDS * sizeof(uint32_t);
+
+        for (uint32_t k = 0; k < size; k++) {
+            if ((size_t) (end - p) < sizeof(uint32_t))
+                goto corrupt;
+            size_t slen = load_word(p);
+            p += sizeof(uint32_t);
+            if ((size_t) (end - p) <= slen || p[slen] ||
+                memchr(p, '\0', slen))
+                goto corrupt;
+            p += slen + 1;
+        }
+    }
+    if (p == end)
+        return true;
+
+corrupt:
+    report(1, "'%s' is truncated or corrupted", name);
+    return false;
+}
+
+/* Free every queue, leaving an empty chain */
+static void free_queues(void)
+{
+    struct list_head *cur = chain.head.next;
+    while (chain.size > 0) {
+        queue_contex_t *qctx = list_entry(cur, queue_contex_t, chain);
+        cur = cur->next;
+        q_free(qctx->q);
+        free(qctx);
+        chain.size--;
+    }
+    INIT_LIST_HEAD(&chain.head);
+    current = NULL;
+}
+
+/* Replace the queues with the ones of a file written by "save". The values
+ * are inserted with q_insert_tail() right out of the mapped file, with
+ * allocation failures held off and without the time limit, which a fixture
+ * of millions of values would exceed.
+ */
+static bool do_load(int argc, char *argv[])
+{
+    if (argc != 2) {
+        report(1, "%s needs a file name", argv[0]);
+        return false;
+    }
+
+    int fd = open(argv[1], O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st)) {
+        report(1, "Cannot open '%s': %s", argv[1], strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return false;
+    }
+
+    size_t len = st.st_size;
+    if (!S_ISREG(st.st_mode) || !len) {
+        report(1, "'%s' is not a file written by save", argv[1]);
+        close(fd);
+        return false;
+    }
+
+    const char *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    int err = errno;
+    close(fd);
+    if (map == MAP_FAILED) {
+        report(1, "Cannot map '%s': %s", argv[1], strerror(err));
+        return false;
+    }
+    madvise((void *) map, len, MADV_SEQUENTIAL);
+
+    if (!load_check(map, len, argv[1])) {
+        munmap((void *) map, len);
+        return false;
+    }
+
+    double t;
+    init_time(&t);
+
+    int saved_fail_probability = fail_probability;
+    fail_probability = 0;
+    set_cautious_mode(false);
+    error_check();
+
+    bool ok = true;
+    long values = 0;
+    uint32_t n = load_word(map + 8), pos = load_word(map + 12);
+    if (exception_setup(false)) {
+        free_queues();
+
+        const char *p = map + SAVE_HEADER_WORDS * sizeof(uint32_t);
+        for (uint32_t i = 0; i < n && ok; i++) {
+            queue_contex_t *qctx = malloc(sizeof(queue_contex_t));
+            if (!qctx || !(qctx->q = q_new())) {
+                free(qctx);
+                ok = false;
+                break;
+            }
+            qctx->id = (int) load_word(p);
+            qctx->size = 0;
+            list_add_tail(&qctx->chain, &chain.head);
+            chain.size++;
+            if (i == pos)
+                current = qctx;
+
+            uint32_t size = load_word(p + 4);
+            p += SAVE_QUEUE_WORDS * sizeof(uint32_t);
+            for (uint32_t k = 0; k < size; k++) {
+                size_t slen = load_word(p);
+                p += sizeof(uint32_t);
+                if (!q_insert_tail(qctx->q, (char *) p)) {
+                    ok = false;
+                    break;
+                }
+                qctx->size++;
+                p += slen + 1;
+            }
+            values += qctx->size;
+        }
+    }
+    exception_cancel();
+
+    set_cautious_mode(true);
+    fail_probability = saved_fail_probability;
+    munmap((void *) map, len);
+
+    if (!ok)
+        report(1, "ERROR: Loading '%s' failed after %ld values", argv[1],
+               values);
+    else
+        report(4, "Loaded %ld values into %u queues in %.3f s", values, n,
+               delta_time(&t));
+
+    q_show(3);
+    return ok && !error_check();
+}
+
+/* Route every source of randomness through a generator keyed by @seed, so
+ * that RAND strings, allocation failures, shuffles and dudect inputs repeat
+ * from run to run. rand() is reseeded as well, for queue code relying on it.
+ */
+static void seed_changed(int oldval)
+{
+    random_seed((unsigned int) data_seed);
+    srand(data_seed ? (unsigned int) data_seed
+                    : os_random(getpid() ^ getppid()));
+}
+
+static void clock_changed(int oldval)
+{
+    if (cpucycles_clock < CPUCYCLES_TSC || cpucycles_clock > CPUCYCLES_PERF) {
+        report(1, "Unknown cycle counter %d", cpucycles_clock);
+        cpucycles_clock = oldval;
+    }
+}
+
 static void console_init()
 {
     ADD_COMMAND(new, "Create new queue", "");
@@ -1080,8 +1966,20 @@ static void console_init()
         "[str]");
     ADD_COMMAND(reverse, "Reverse queue", "");
     ADD_COMMAND(sort, "Sort queue in ascending/descending order", "");
+    ADD_COMMAND(shuffle,
+                "Shuffle queue, or check the uniformity of n shuffles of a "
+                "queue of at most 8 elements",
+                "[n]");
     ADD_COMMAND(size, "Compute queue size n times (default: n == 1)", "[n]");
     ADD_COMMAND(show, "Show queue contents", "");
+    ADD_COMMAND(stats,
+                "Report byte entropy, length histogram, distinct count and "
+                "min/max of all values in queue",
+                "");
+    ADD_COMMAND(footprint,
+                "Report memory used per element by the queue and by a compact "
+                "copy of it",
+                "");
     ADD_COMMAND(dm, "Delete middle node in queue", "");
     ADD_COMMAND(dedup, "Delete all nodes that have duplicate string", "");
     ADD_COMMAND(merge, "Merge all the queues into one sorted queue", "");
@@ -1096,6 +1994,9 @@ static void console_init()
                 "");
     ADD_COMMAND(reverseK, "Reverse the nodes of the queue 'K' at a time",
                 "[K]");
+    ADD_COMMAND(save, "Write all queues to file", "file");
+    ADD_COMMAND(load, "Replace all queues with the ones saved in file",
+                "file");
     add_param("length", &string_length, "Maximum length of displayed string",
               NULL);
     add_param("malloc", &fail_probability, "Malloc failure probability percent",
@@ -1104,6 +2005,13 @@ static void console_init()
               "Number of times allow queue operations to return false", NULL);
     add_param("descend", &descend,
               "Sort and merge queue in ascending/descending order", NULL);
+    add_param("seed", &data_seed,
+              "Seed for reproducible random data (0: seed from OS entropy)",
+              seed_changed);
+    add_param("clock", &cpucycles_clock,
+              "Cycle counter of simulation mode (0: TSC, 1: fenced TSC, 2: "
+              "perf_event_open)",
+              clock_changed);
 }
 
 /* Signal handlers */
@@ -1139,16 +2047,8 @@ static bool q_quit(int argc, char *argv[])
     if (current && current->size > BIG_LIST_SIZE)
         set_cautious_mode(false);
 
-    if (exception_setup(true)) {
-        struct list_head *cur = chain.head.next;
-        while (chain.size > 0) {
-            queue_contex_t *qctx = list_entry(cur, queue_contex_t, chain);
-            cur = cur->next;
-            q_free(qctx->q);
-            free(qctx);
-            chain.size--;
-        }
-    }
+    if (exception_setup(true))
+        free_queues();
 
     exception_cancel();
     set_cautious_mode(true);
@@ -1165,11 +2065,14 @@ static bool q_quit(int argc, char *argv[])
 
 static void usage(char *cmd)
 {
-    printf("Usage: %s [-h] [-f FILE][-v LEVEL][-l LOG\n", cmd);
+    printf("Usage: %s [-h] [-f FILE][-v LEVEL][-l LOG][-s SEED][-c OUT]\n",
+           cmd);
     printf("\t-h         Print this information\n");
     printf("\t-f FILE   Read commands from FILE\n");
     printf("\t-v LEVEL  Set verbosity level\n");
     printf("\t-l LOG    Echo results to LOG\n");
+    printf("\t-s SEED   Generate reproducible random data from SEED\n");
+    printf("\t-c OUT    Compile FILE into OUT, to be replayed faster with -f\n");
     exit(0);
 }
 
@@ -1376,10 +2279,11 @@ int main(int argc, char *argv[])
     char *infile_name = NULL;
     char lbuf[BUFSIZE];
     char *logfile_name = NULL;
+    char *compile_name = NULL;
     int level = 4;
     int c;
 
-    while ((c = getopt(argc, argv, "hv:f:l:")) != -1) {
+    while ((c = getopt(argc, argv, "hv:f:l:s:c:")) != -1) {
         switch (c) {
         case 'h':
             usage(argv[0]);
@@ -1404,6 +2308,15 @@ int main(int argc, char *argv[])
             buf[BUFSIZE - 1] = '\0';
             logfile_name = lbuf;
             break;
+        case 's':
+            if (!get_int(optarg, &data_seed)) {
+                fprintf(stderr, "Invalid seed\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'c':
+            compile_name = optarg;
+            break;
         default:
             printf("Unknown option '%c'\n", c);
             usage(argv[0]);
@@ -1415,6 +2328,16 @@ int main(int argc, char *argv[])
      * with the Unix time.
      */
     srand(os_random(getpid() ^ getppid()));
+    if (data_seed)
+        seed_changed(0);
+
+    if (compile_name) {
+        if (!infile_name) {
+            fprintf(stderr, "Nothing to compile, use -f FILE\n");
+            exit(EXIT_FAILURE);
+        }
+        return !compile_trace(infile_name, compile_name);
+    }
 
     q_init();
     init_cmd();
@@ -1436,6 +2359,7 @@ int main(int argc, char *argv[])
         set_logfile(logfile_name);
 
     add_quit_helper(q_quit);
+    set_snapshot_helpers(snapshot_save, snapshot_restore, snapshot_discard);
 
     bool ok = true;
     ok = ok && run_console(infile_name);
@@ -2,7 +2,9 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "list_sort.h"
 #include "queue.h"
+#include "random.h"
 
 /* Create an empty queue */
 struct list_head *q_new()
@@ -23,7 +25,7 @@ void q_free(struct list_head *head)
         return;
 
     element_t *pos = NULL, *next = NULL;
-    list_for_each_entry_safe(pos, next, head, list) {
+    list_for_each_entry_safe_prefetch(pos, next, head, list) {
         list_del(&pos->list);
         q_release_element(pos);
     }
@@ -113,7 +115,7 @@ int q_size(struct list_head *head)
     int len = 0;
     struct list_head *li;
 
-    list_for_each(li, head)
+    list_for_each_prefetch(li, head)
         len++;
 
     return len;
@@ -151,6 +153,7 @@ bool q_delete_dup(struct list_head *head)
     while (cur != head) {
         element_t *e = list_entry(cur, element_t, list);
         bool duplicated = false;
+        list_prefetch(cur->next->next);
 
         // Check if subsequent nodes have the same string value
         while (cur->next != head &&
@@ -182,12 +185,22 @@ void q_swap(struct list_head *head)
     if (!head || list_empty(head) || list_is_singular(head))
         return;
 
-    struct list_head *cur = head->next, *next = cur->next;
+    struct list_head *prev = head, *first = head->next;
 
-    while (cur->next != head && cur != head) {
-        list_move(next, cur->prev);
-        cur = cur->next;
-        next = cur->next;
+    /* Relink each pair (first, second) in place as (second, first) */
+    while (first != head && first->next != head) {
+        struct list_head *second = first->next, *next = second->next;
+        list_prefetchw(next->next);
+
+        prev->next = second;
+        second->prev = prev;
+        second->next = first;
+        first->prev = second;
+        first->next = next;
+        next->prev = first;
+
+        prev = first;
+        first = next;
     }
 }
 
@@ -197,10 +210,17 @@ void q_reverse(struct list_head *head)
     if (!head || list_empty(head) || list_is_singular(head))
         return;
 
-    struct list_head *temp = NULL, *safe = NULL;
-
-    list_for_each_safe(temp, safe, head)
-        list_move(temp, head);
+    /* Reversing a circular doubly-linked list only needs the two links of
+     * every node, the head included, to trade places.
+     */
+    struct list_head *node = head;
+    do {
+        struct list_head *next = node->next;
+        list_prefetchw(next->next);
+        node->next = node->prev;
+        node->prev = next;
+        node = next;
+    } while (node != head);
 }
 
 /* Reverse the nodes of the list k at a time */
@@ -211,7 +231,7 @@ void q_reverseK(struct list_head *head, int k)
 
     int len = 0;
     struct list_head *node;
-    list_for_each(node, head)
+    list_for_each_prefetch(node, head)
         len++;
 
     // 'pre' points to the tail of the processed segment (initially the dummy
@@ -248,67 +268,57 @@ void q_reverseK(struct list_head *head, int k)
     }
 }
 
-struct list_head *q_split(struct list_head *head)
-{
-    struct list_head *slow = head->next, *fast = head->next;
-
-    while (fast->next != head && fast->next->next != head) {
-        slow = slow->next;
-        fast = fast->next->next;
-    }
-
-    return slow;
-}
-
-void q_mergeLeftRight(struct list_head *head,
-                      struct list_head *left,
-                      struct list_head *right,
-                      bool descend)
+/* Sort elements of queue in ascending/descending order */
+void q_sort(struct list_head *head, bool descend)
 {
-    while (!list_empty(left) && !list_empty(right)) {
-        element_t *ele_l = list_first_entry(left, element_t, list);
-        element_t *ele_r = list_first_entry(right, element_t, list);
-
-        int cmp_result = strcmp(ele_l->value, ele_r->value);
-
-        if ((descend && cmp_result >= 0) || (!descend && cmp_result > 0)) {
-            list_move_tail(&ele_r->list, head);
-        } else {
-            list_move_tail(&ele_l->list, head);
-        }
-    }
+    if (!head || list_empty(head) || list_is_singular(head))
+        return;
 
-    list_splice_tail_init(left, head);
-    list_splice_tail_init(right, head);
+    list_sort_str(head, offsetof(element_t, value) - offsetof(element_t, list),
+                  descend);
 }
 
-void q_merge_sort(struct list_head *head, bool descend)
+/* Shuffle elements of queue uniformly at random */
+bool q_shuffle(struct list_head *head)
 {
+    if (!head)
+        return false;
     if (list_empty(head) || list_is_singular(head))
-        return;
-
-    struct list_head *mid = q_split(head);
-
-    struct list_head left, right;
-    INIT_LIST_HEAD(&left);
-    INIT_LIST_HEAD(&right);
-
-    list_cut_position(&left, head, mid);
-    list_splice_init(head, &right);
-    INIT_LIST_HEAD(head);
-
-    q_merge_sort(&left, descend);
-    q_merge_sort(&right, descend);
+        return true;
+
+    struct list_head *stack[Q_SHUFFLE_STACK], **nodes = stack;
+    size_t n = q_size(head);
+    if (n > Q_SHUFFLE_STACK) {
+        nodes = malloc(n * sizeof(*nodes));
+        if (!nodes)
+            return false;
+    }
 
-    q_mergeLeftRight(head, &left, &right, descend);
-}
+    size_t i = 0;
+    struct list_head *node;
+    list_for_each(node, head)
+        nodes[i++] = node;
+
+    prng_state_t *rng = prng_default();
+    for (i = n - 1; i > 0; i--) {
+        size_t j = prng_below(rng, i + 1);
+        struct list_head *tmp = nodes[i];
+        nodes[i] = nodes[j];
+        nodes[j] = tmp;
+    }
 
-void q_sort(struct list_head *head, bool descend)
-{
-    if (!head || list_empty(head) || list_is_singular(head))
-        return;
+    struct list_head *prev = head;
+    for (i = 0; i < n; i++) {
+        prev->next = nodes[i];
+        nodes[i]->prev = prev;
+        prev = nodes[i];
+    }
+    prev->next = head;
+    head->prev = prev;
 
-    q_merge_sort(head, descend);
+    if (nodes != stack)
+        free(nodes);
+    return true;
 }
 
 /* Remove every node which has a node with a strictly less value anywhere to
@@ -323,6 +333,7 @@ int q_ascend(struct list_head *head)
     struct list_head *right = head->prev, *left = right->prev;
 
     while (left != head) {
+        list_prefetch(left->prev);
         const element_t *ele_l = list_entry(left, element_t, list);
         const element_t *ele_r = list_entry(right, element_t, list);
 
@@ -355,6 +366,7 @@ int q_descend(struct list_head *head)
     struct list_head *right = head->prev, *left = right->prev;
 
     while (left != head) {
+        list_prefetch(left->prev);
         const element_t *ele_l = list_entry(left, element_t, list);
         const element_t *ele_r = list_entry(right, element_t, list);
 
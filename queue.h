@@ -200,6 +200,22 @@ void q_reverseK(struct list_head *head, int k);
  */
 void q_sort(struct list_head *head, bool descend);
 
+/* Queues up to this size are shuffled using a pointer array on the stack */
+#define Q_SHUFFLE_STACK 64
+
+/**
+ * q_shuffle() - Shuffle elements of queue uniformly at random
+ * @head: header of queue
+ *
+ * Fisher-Yates shuffle over an array of the node pointers, drawing from
+ * prng_default(), followed by a single relinking pass, so the cost is O(n).
+ * Queues of up to Q_SHUFFLE_STACK elements are shuffled without allocating.
+ *
+ * Return: false if queue is NULL or the pointer array cannot be allocated,
+ * in which case the queue is left untouched.
+ */
+bool q_shuffle(struct list_head *head);
+
 /**
  * q_ascend() - Delete every node which has a node with a strictly less
  * value anywhere to the right side of it.
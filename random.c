@@ -28,6 +28,18 @@
 #define _GNU_SOURCE
 #endif
 
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_ALPHA_AVX2
+#endif
+#endif
+
 #include "random.h"
 
 #if defined(__linux__) || defined(__GNU__)
@@ -291,3 +303,263 @@ int randombytes(uint8_t *buf, size_t n)
 #error "randombytes(...) is not supported on this platform"
 #endif
 }
+
+/* Buffered ChaCha20 generator
+ *
+ * randombytes() costs a system call per request, however small. Instead, a
+ * ChaCha20 key drawn from it once feeds a userspace buffer of keystream. Each
+ * refill overwrites the key with the first bytes of the new keystream, so a
+ * leaked state does not reveal earlier output, and fresh bytes from the
+ * operating system are mixed into the key every RANDOM_RESEED_BYTES.
+ *
+ * The generator is not thread-safe.
+ */
+#define CHACHA_BLOCK_SIZE 64
+#define CHACHA_KEY_SIZE 32
+#define RANDOM_BUF_BLOCKS 4
+#define RANDOM_RESEED_BYTES (1 << 20)
+
+static struct {
+    uint32_t key[CHACHA_KEY_SIZE / 4];
+    uint64_t counter;
+    uint8_t buf[RANDOM_BUF_BLOCKS * CHACHA_BLOCK_SIZE];
+    size_t pos;
+    size_t since_reseed;
+    bool seeded;
+    bool fixed; /* keyed by random_seed(), never reseeded */
+} rng = {.pos = RANDOM_BUF_BLOCKS * CHACHA_BLOCK_SIZE};
+
+static inline uint32_t rotl32(uint32_t x, int k)
+{
+    return (x << k) | (x >> (32 - k));
+}
+
+#define QUARTERROUND(a, b, c, d)   \
+    do {                           \
+        a += b;                    \
+        d = rotl32(d ^ a, 16);     \
+        c += d;                    \
+        b = rotl32(b ^ c, 12);     \
+        a += b;                    \
+        d = rotl32(d ^ a, 8);      \
+        c += d;                    \
+        b = rotl32(b ^ c, 7);      \
+    } while (0)
+
+/* Compute the ChaCha20 block for input state @in into @out, little-endian */
+static void chacha20_block(const uint32_t in[16], uint8_t *out)
+{
+    uint32_t x[16];
+    memcpy(x, in, sizeof(x));
+
+    for (int i = 0; i < 10; i++) {
+        QUARTERROUND(x[0], x[4], x[8], x[12]);
+        QUARTERROUND(x[1], x[5], x[9], x[13]);
+        QUARTERROUND(x[2], x[6], x[10], x[14]);
+        QUARTERROUND(x[3], x[7], x[11], x[15]);
+        QUARTERROUND(x[0], x[5], x[10], x[15]);
+        QUARTERROUND(x[1], x[6], x[11], x[12]);
+        QUARTERROUND(x[2], x[7], x[8], x[13]);
+        QUARTERROUND(x[3], x[4], x[9], x[14]);
+    }
+
+    for (int i = 0; i < 16; i++) {
+        uint32_t v = x[i] + in[i];
+        out[4 * i] = v;
+        out[4 * i + 1] = v >> 8;
+        out[4 * i + 2] = v >> 16;
+        out[4 * i + 3] = v >> 24;
+    }
+}
+
+static inline uint32_t load32_le(const uint8_t *p)
+{
+    return (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 |
+           (uint32_t) p[3] << 24;
+}
+
+/* Mix fresh operating system randomness into the key */
+static void random_reseed(void)
+{
+    uint8_t seed[CHACHA_KEY_SIZE] = {0};
+    if (randombytes(seed, sizeof(seed)) != 0 && !rng.seeded) {
+        /* Never run from a predictable all-zero key */
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        uintptr_t mix[] = {(uintptr_t) ts.tv_sec, (uintptr_t) ts.tv_nsec,
+                           (uintptr_t) &ts, (uintptr_t) getpid()};
+        memcpy(seed, mix, sizeof(mix) < sizeof(seed) ? sizeof(mix)
+                                                     : sizeof(seed));
+    }
+
+    for (size_t i = 0; i < CHACHA_KEY_SIZE / 4; i++)
+        rng.key[i] ^= load32_le(seed + 4 * i);
+    memset(seed, 0, sizeof(seed));
+    rng.since_reseed = 0;
+    rng.seeded = true;
+}
+
+static void random_refill(void)
+{
+    if (!rng.seeded || (!rng.fixed && rng.since_reseed >= RANDOM_RESEED_BYTES))
+        random_reseed();
+
+    /* "expand 32-byte k", key, 64-bit block counter and a zero nonce */
+    uint32_t in[16] = {0x61707865, 0x3320646e, 0x79622d32, 0x6b206574};
+    memcpy(in + 4, rng.key, sizeof(rng.key));
+    for (int b = 0; b < RANDOM_BUF_BLOCKS; b++, rng.counter++) {
+        in[12] = rng.counter;
+        in[13] = rng.counter >> 32;
+        chacha20_block(in, rng.buf + b * CHACHA_BLOCK_SIZE);
+    }
+
+    /* Fast key erasure: the first bytes become the next key, never output */
+    for (size_t i = 0; i < CHACHA_KEY_SIZE / 4; i++)
+        rng.key[i] = load32_le(rng.buf + 4 * i);
+    memset(rng.buf, 0, CHACHA_KEY_SIZE);
+    rng.pos = CHACHA_KEY_SIZE;
+    rng.since_reseed += sizeof(rng.buf);
+}
+
+void random_fill(void *buf, size_t len)
+{
+    uint8_t *out = buf;
+    while (len > 0) {
+        if (rng.pos == sizeof(rng.buf))
+            random_refill();
+
+        size_t n = sizeof(rng.buf) - rng.pos;
+        if (n > len)
+            n = len;
+        memcpy(out, rng.buf + rng.pos, n);
+        /* Bytes handed out are wiped from the buffer */
+        memset(rng.buf + rng.pos, 0, n);
+        rng.pos += n;
+        out += n;
+        len -= n;
+    }
+}
+
+uint64_t random_u64(void)
+{
+    uint64_t x;
+    random_fill(&x, sizeof(x));
+    return x;
+}
+
+/* Lowercase letters from 16 random bits each: the letter is the high half of
+ * bits * 26, which needs no rejection loop and is off from uniform by at most
+ * 26 / 65536. Vector versions below do the same 16 or 32 characters at a time
+ * with a high-half multiply and a saturating pack.
+ */
+#define ALPHA_CHUNK 256
+
+static void alpha_scalar(char *dst, const uint16_t *bits, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+        dst[i] = 'a' + (((uint32_t) bits[i] * 26) >> 16);
+}
+
+#if defined(__SSE2__)
+static void alpha_sse2(char *dst, const uint16_t *bits, size_t len)
+{
+    const __m128i k26 = _mm_set1_epi16(26), ka = _mm_set1_epi8('a');
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i lo = _mm_loadu_si128((const __m128i *) (bits + i));
+        __m128i hi = _mm_loadu_si128((const __m128i *) (bits + i + 8));
+        lo = _mm_mulhi_epu16(lo, k26);
+        hi = _mm_mulhi_epu16(hi, k26);
+        _mm_storeu_si128((__m128i *) (dst + i),
+                         _mm_add_epi8(_mm_packus_epi16(lo, hi), ka));
+    }
+    alpha_scalar(dst + i, bits + i, len - i);
+}
+#endif
+
+#if defined(HAVE_ALPHA_AVX2)
+__attribute__((target("avx2"))) static void alpha_avx2(char *dst,
+                                                        const uint16_t *bits,
+                                                        size_t len)
+{
+    const __m256i k26 = _mm256_set1_epi16(26), ka = _mm256_set1_epi8('a');
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i lo = _mm256_loadu_si256((const __m256i *) (bits + i));
+        __m256i hi = _mm256_loadu_si256((const __m256i *) (bits + i + 16));
+        lo = _mm256_mulhi_epu16(lo, k26);
+        hi = _mm256_mulhi_epu16(hi, k26);
+        /* The pack works within 128-bit lanes, put them back in order */
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi),
+                                                  _MM_SHUFFLE(3, 1, 2, 0));
+        _mm256_storeu_si256((__m256i *) (dst + i),
+                            _mm256_add_epi8(packed, ka));
+    }
+    alpha_sse2(dst + i, bits + i, len - i);
+}
+#endif
+
+void random_alpha(char *dst, size_t len)
+{
+    static void (*alpha)(char *, const uint16_t *, size_t);
+    if (!alpha) {
+#if defined(HAVE_ALPHA_AVX2)
+        __builtin_cpu_init();
+        alpha = __builtin_cpu_supports("avx2") ? alpha_avx2 : alpha_sse2;
+#elif defined(__SSE2__)
+        alpha = alpha_sse2;
+#else
+        alpha = alpha_scalar;
+#endif
+    }
+
+    uint16_t bits[ALPHA_CHUNK];
+    while (len > 0) {
+        size_t n = len < ALPHA_CHUNK ? len : ALPHA_CHUNK;
+        random_fill(bits, n * sizeof(uint16_t));
+        alpha(dst, bits, n);
+        dst += n;
+        len -= n;
+    }
+}
+
+/* Seed given to random_seed(), and how many times it was called */
+static uint64_t fixed_seed;
+static unsigned int seed_generation = 1;
+
+prng_state_t *prng_stream(prng_stream_t *s)
+{
+    if (s->generation != seed_generation) {
+        prng_seed(&s->state,
+                  rng.fixed ? fixed_seed ^ (s->id * 0xd1342543de82ef95ULL)
+                            : random_u64());
+        s->generation = seed_generation;
+    }
+    return &s->state;
+}
+
+prng_state_t *prng_default(void)
+{
+    static prng_stream_t stream = {.id = 1};
+    return prng_stream(&stream);
+}
+
+void random_seed(uint64_t seed)
+{
+    memset(&rng, 0, sizeof(rng));
+    rng.pos = sizeof(rng.buf);
+
+    if (seed) {
+        /* Expand the seed into a key with splitmix64 */
+        prng_state_t st;
+        prng_seed(&st, seed);
+        for (int i = 0; i < 4; i++) {
+            rng.key[2 * i] = st.s[i];
+            rng.key[2 * i + 1] = st.s[i] >> 32;
+        }
+        rng.seeded = rng.fixed = true;
+    }
+
+    fixed_seed = seed;
+    seed_generation++;
+}
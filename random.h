@@ -6,11 +6,24 @@
 
 extern int randombytes(uint8_t *buf, size_t len);
 
+/* Fill @buf with @len bytes from a userspace ChaCha20 generator, seeded and
+ * periodically reseeded from randombytes(). Prefer this over randombytes()
+ * for anything that is not a key or a seed: it makes no system call per
+ * request.
+ */
+void random_fill(void *buf, size_t len);
+
+/* Draw 64 bits from the same generator as random_fill() */
+uint64_t random_u64(void);
+
+/* Fill @dst with @len random lowercase letters, no terminating NUL. Uses
+ * SSE2 or AVX2, when available, to map the random bits to letters.
+ */
+void random_alpha(char *dst, size_t len);
+
 static inline uint8_t randombit(void)
 {
-    uint8_t ret = 0;
-    randombytes(&ret, 1);
-    return ret & 1;
+    return random_u64() & 1;
 }
 
 #if INTPTR_MAX == INT64_MAX
@@ -48,4 +61,107 @@ static inline uintptr_t random_shuffle(uintptr_t x)
     return x;
 }
 
+/* Fast, non-cryptographic generator for simulation work such as shuffling,
+ * where randombytes() would cost a system call per draw.
+ */
+typedef struct {
+    uint64_t s[4];
+} prng_state_t;
+
+static inline uint64_t prng_rotl(uint64_t x, int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+/* Expand @seed into a full state with splitmix64, which never yields the
+ * all-zero state xoshiro cannot leave.
+ */
+static inline void prng_seed(prng_state_t *st, uint64_t seed)
+{
+    for (int i = 0; i < 4; i++) {
+        uint64_t z = (seed += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        st->s[i] = z ^ (z >> 31);
+    }
+}
+
+/* xoshiro256** by David Blackman and Sebastiano Vigna, see:
+ * <https://prng.di.unimi.it/xoshiro256starstar.c>
+ */
+static inline uint64_t prng_next(prng_state_t *st)
+{
+    uint64_t *s = st->s;
+    const uint64_t result = prng_rotl(s[1] * 5, 7) * 9;
+    const uint64_t t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = prng_rotl(s[3], 45);
+
+    return result;
+}
+
+/* Full 128-bit product of @a and @b, high half returned, low half in @lo */
+static inline uint64_t prng_mul128(uint64_t a, uint64_t b, uint64_t *lo)
+{
+#ifdef __SIZEOF_INT128__
+    __uint128_t m = (__uint128_t) a * b;
+    *lo = (uint64_t) m;
+    return (uint64_t) (m >> 64);
+#else
+    uint64_t a_lo = (uint32_t) a, a_hi = a >> 32;
+    uint64_t b_lo = (uint32_t) b, b_hi = b >> 32;
+    uint64_t p0 = a_lo * b_lo, p1 = a_lo * b_hi, p2 = a_hi * b_lo;
+    uint64_t mid = (p0 >> 32) + (uint32_t) p1 + (uint32_t) p2;
+    *lo = (mid << 32) | (uint32_t) p0;
+    return a_hi * b_hi + (p1 >> 32) + (p2 >> 32) + (mid >> 32);
+#endif
+}
+
+/* Uniform integer in [0, @bound), @bound > 0, without modulo bias. Uses
+ * Lemire's multiply-and-shift, which only divides on the rare rejection path.
+ */
+static inline uint64_t prng_below(prng_state_t *st, uint64_t bound)
+{
+    uint64_t low, high = prng_mul128(prng_next(st), bound, &low);
+    if (low < bound) {
+        const uint64_t threshold = -bound % bound;
+        while (low < threshold)
+            high = prng_mul128(prng_next(st), bound, &low);
+    }
+    return high;
+}
+
+/**
+ * prng_stream_t - Generator drawing its own sequence
+ * @state: generator state
+ * @id: distinct number per stream
+ * @generation: value of the seed generation @state was seeded for
+ *
+ * Under random_seed() each stream is keyed by the seed and @id alone, so what
+ * it yields does not depend on how much other code drew from other streams
+ * in the meantime. Declare it static, zero-initialized apart from @id.
+ */
+typedef struct {
+    prng_state_t state;
+    uint64_t id;
+    unsigned int generation;
+} prng_stream_t;
+
+/* State of @s, (re)seeded on first use and after each random_seed() */
+prng_state_t *prng_stream(prng_stream_t *s);
+
+/* Generator shared by the program */
+prng_state_t *prng_default(void);
+
+/* Make random_fill(), random_u64(), random_alpha() and every prng_stream_t
+ * produce a fixed sequence derived from @seed, the same on every run and build.
+ * A @seed of 0 switches back to randomness from the operating system.
+ */
+void random_seed(uint64_t seed);
+
 #endif
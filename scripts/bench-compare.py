@@ -0,0 +1,109 @@
+#!/usr/bin/env python3
+
+# Compare two result files of 'qbench -s -j FILE': the samples of each
+# workload present in both are checked with a one-sided Mann-Whitney U test,
+# and a workload is flagged as a regression when its median got slower by more
+# than the threshold with a p-value below alpha. The p-values are adjusted
+# with the Holm method across workloads, so that alpha bounds the chance of
+# flagging any of them when nothing changed. The exit status is nonzero when
+# any workload regressed.
+
+import argparse
+import json
+import math
+import sys
+
+
+def median(xs):
+    s = sorted(xs)
+    mid = len(s) // 2
+    return s[mid] if len(s) % 2 else (s[mid - 1] + s[mid]) / 2
+
+
+def mannwhitney(old, new):
+    # p-value of the hypothesis that @new is not slower than @old, from the
+    # normal approximation of U with tie and continuity corrections
+    n1, n2 = len(old), len(new)
+    if not n1 or not n2:
+        return 1.0
+    merged = sorted([(x, 0) for x in old] + [(x, 1) for x in new])
+    n = n1 + n2
+    rank_new, ties, i = 0.0, 0, 0
+    while i < n:
+        j = i
+        while j < n and merged[j][0] == merged[i][0]:
+            j += 1
+        # Tied samples share the average of the ranks i + 1 .. j
+        rank = (i + j + 1) / 2
+        rank_new += rank * sum(1 for k in range(i, j) if merged[k][1])
+        ties += (j - i) ** 3 - (j - i)
+        i = j
+    u = rank_new - n2 * (n2 + 1) / 2
+    var = n1 * n2 / 12 * (n + 1 - ties / (n * (n - 1)))
+    if var <= 0:
+        return 1.0
+    z = (u - n1 * n2 / 2 - 0.5) / math.sqrt(var)
+    return 0.5 * math.erfc(z / math.sqrt(2))
+
+
+def holm(ps):
+    # Holm-adjusted p-values, in the order of @ps
+    order = sorted(range(len(ps)), key=lambda i: ps[i])
+    adjusted, running = [1.0] * len(ps), 0.0
+    for rank, i in enumerate(order):
+        running = max(running, min(1.0, (len(ps) - rank) * ps[i]))
+        adjusted[i] = running
+    return adjusted
+
+
+def load(path):
+    with open(path) as f:
+        data = json.load(f)
+    return {(r["name"], r["n"]): r["samples"] for r in data["results"]}
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Flag significant slowdowns between two qbench -s runs")
+    parser.add_argument("-a", "--alpha", type=float, default=0.01,
+                        help="significance level (default: %(default)s)")
+    parser.add_argument("-t", "--threshold", type=float, default=5,
+                        help="change of the median in percent below which a "
+                        "difference is ignored (default: %(default)s)")
+    parser.add_argument("baseline", help="results of the reference build")
+    parser.add_argument("current", help="results of the build under test")
+    args = parser.parse_args()
+
+    old, new = load(args.baseline), load(args.current)
+    keys = [k for k in new if k in old]
+    slower = holm([mannwhitney(old[k], new[k]) for k in keys])
+    faster = holm([mannwhitney(new[k], old[k]) for k in keys])
+    regressions = 0
+    for key, p_slow, p_fast in zip(keys, slower, faster):
+        ma, mb = median(old[key]), median(new[key])
+        if ma > 0:
+            change = 100 * (mb - ma) / ma
+        else:
+            change = 0.0 if mb == ma else math.inf
+        if change > args.threshold and p_slow < args.alpha:
+            verdict = "REGRESSION"
+            regressions += 1
+        elif change < -args.threshold and p_fast < args.alpha:
+            verdict = "improved"
+        else:
+            verdict = ""
+        print("%-14s n=%-10d %9.2f -> %9.2f ns/node %+7.1f%%  p=%.4f  %s" %
+              (key[0], key[1], ma, mb, change,
+               p_slow if change >= 0 else p_fast, verdict))
+
+    missing = [k for k in old if k not in new]
+    for name, n in missing:
+        print("%-14s n=%-10d missing from %s" % (name, n, args.current))
+
+    print("%d regression(s) at alpha %g, threshold %g%%" %
+          (regressions, args.alpha, args.threshold))
+    return 1 if regressions else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
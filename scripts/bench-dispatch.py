@@ -0,0 +1,77 @@
+#!/usr/bin/env python3
+
+# Measure the per-line cost of the qtest command interpreter: a trace of many
+# cheap commands is generated, so that reading, parsing and dispatching lines
+# dominates the run time, and each qtest binary given is timed on it.
+
+import argparse
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+# Commands which do next to nothing on an empty queue
+CHEAP_COMMANDS = [
+    "size",
+    "option echo 0",
+    "swap",
+    "option entropy 0",
+    "reverse",
+    "option error 5",
+]
+
+
+def write_trace(f, lines):
+    f.write("new\n")
+    for i in range(lines):
+        f.write(CHEAP_COMMANDS[i % len(CHEAP_COMMANDS)] + "\n")
+    f.write("free\n")
+
+
+def run(qtest, trace, reps):
+    best = None
+    for _ in range(reps):
+        start = time.perf_counter()
+        ret = subprocess.call([qtest, "-v", "0", "-f", trace],
+                              stdout=subprocess.DEVNULL)
+        elapsed = time.perf_counter() - start
+        if ret != 0:
+            print("%s exited with status %d" % (qtest, ret), file=sys.stderr)
+            return None
+        best = elapsed if best is None else min(best, elapsed)
+    return best
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Time command dispatch of qtest on a trace of cheap "
+        "commands")
+    parser.add_argument("-n", "--lines", type=int, default=1000000,
+                        help="number of commands (default: %(default)s)")
+    parser.add_argument("-r", "--reps", type=int, default=3,
+                        help="runs per binary, the best is kept "
+                        "(default: %(default)s)")
+    parser.add_argument("qtest", nargs="*", default=["./qtest"],
+                        help="qtest binaries to compare (default: ./qtest)")
+    args = parser.parse_args()
+
+    fd, trace = tempfile.mkstemp(prefix="dispatch-", suffix=".cmd")
+    try:
+        with os.fdopen(fd, "w") as f:
+            write_trace(f, args.lines)
+        ok = True
+        for qtest in args.qtest:
+            elapsed = run(qtest, trace, args.reps)
+            if elapsed is None:
+                ok = False
+                continue
+            print("%-24s %8.3f s, %7.1f ns/line" %
+                  (qtest, elapsed, elapsed * 1e9 / (args.lines + 2)))
+    finally:
+        os.unlink(trace)
+    return 0 if ok else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
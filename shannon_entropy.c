@@ -1,4 +1,5 @@
 #include <assert.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <string.h>
 
@@ -8,27 +9,47 @@
 /* Shannon full integer entropy calculation */
 #define BUCKET_SIZE (1 << 8)
 
-double shannon_entropy(const uint8_t *s)
+/* Entropy of @s, counting its bytes in @bucket, which must be all zero on
+ * entry and is left all zero. Only the buckets of bytes present in @s are
+ * visited, which keeps short strings from paying for all 256 of them.
+ */
+static double entropy_of(uint32_t *bucket, const uint8_t *s)
 {
-    assert(s);
-    const uint64_t count = strlen((char *) s);
+    uint64_t count = 0;
+    for (; s[count]; count++)
+        bucket[s[count]]++;
+
     uint64_t entropy_sum = 0;
     const uint64_t entropy_max = 8 * LOG2_RET_SHIFT;
 
-    uint32_t bucket[BUCKET_SIZE];
-    memset(&bucket, 0, sizeof(bucket));
-
-    for (uint32_t i = 0; i < count; i++)
-        bucket[s[i]]++;
-
-    for (uint32_t i = 0; i < BUCKET_SIZE; i++) {
-        if (bucket[i]) {
-            uint64_t p = bucket[i];
-            p *= LOG2_ARG_SHIFT / count;
-            entropy_sum += -p * log2_lshift16(p);
-        }
+    for (uint64_t i = 0; i < count; i++) {
+        uint64_t p = bucket[s[i]];
+        if (!p)
+            continue;
+        /* Clear the bucket so that each byte value is accounted once */
+        bucket[s[i]] = 0;
+        p *= LOG2_ARG_SHIFT / count;
+        entropy_sum += -p * log2_lshift16(p);
     }
 
     entropy_sum /= LOG2_ARG_SHIFT;
     return entropy_sum * 100.0 / entropy_max;
 }
+
+double shannon_entropy(const uint8_t *s)
+{
+    assert(s);
+    uint32_t bucket[BUCKET_SIZE];
+    memset(&bucket, 0, sizeof(bucket));
+    return entropy_of(bucket, s);
+}
+
+void shannon_entropy_batch(const uint8_t *const *strs, size_t n, double *out)
+{
+    uint32_t bucket[BUCKET_SIZE];
+    memset(&bucket, 0, sizeof(bucket));
+    for (size_t i = 0; i < n; i++) {
+        assert(strs[i]);
+        out[i] = entropy_of(bucket, strs[i]);
+    }
+}
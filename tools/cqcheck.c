@@ -0,0 +1,305 @@
+/* Differential test of the compact queue
+ *
+ * Random sequences of operations are applied both to a compact queue of
+ * cqueue.c and to a list_head queue of queue.c, and after every step the two
+ * queues must hold the same strings in both directions, with every operation
+ * having returned the same result. Short keys over a small alphabet make
+ * duplicates and ties common; an occasional long key exercises arena growth
+ * and truncation on removal.
+ *
+ * Usage: cqcheck [-h] [-r ROUNDS] [-l OPS] [-s SEED]
+ */
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* queue.c is linked without the test harness */
+#define INTERNAL 1
+#include "cqueue.h"
+#include "harness.h"
+#include "queue.h"
+
+/* Allocation hooks normally provided by harness.c */
+
+void *test_malloc(size_t size)
+{
+    return malloc(size);
+}
+
+void *test_calloc(size_t nelem, size_t elsize)
+{
+    return calloc(nelem, elsize);
+}
+
+void test_free(void *p)
+{
+    free(p);
+}
+
+char *test_strdup(const char *s)
+{
+    return strdup(s);
+}
+
+#define DEFAULT_ROUNDS 200
+#define DEFAULT_OPS 2000
+
+#define MAX_KEY 300
+#define MAX_BUF 16
+
+static uint64_t state;
+
+/* xorshift64*, reproducible from the seed printed on failure */
+static uint64_t next_random(void)
+{
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 0x2545f4914f6cdd1dULL;
+}
+
+static size_t pick(size_t n)
+{
+    return next_random() % n;
+}
+
+static void random_key(char *buf)
+{
+    size_t len = pick(16) ? 1 + pick(4) : 1 + pick(MAX_KEY - 1);
+    for (size_t i = 0; i < len; i++)
+        buf[i] = 'a' + pick(4);
+    buf[len] = '\0';
+}
+
+/* Report whether @head and @cq hold the same strings, walking both ways */
+static bool same_contents(struct list_head *head, const cqueue_t *cq)
+{
+    if (q_size(head) != cq_size(cq))
+        return false;
+
+    cq_index_t i = cq_first(cq);
+    element_t *e;
+    list_for_each_entry(e, head, list) {
+        if (i == CQ_HEAD || strcmp(e->value, cq_value(cq, i)))
+            return false;
+        i = cq_next(cq, i);
+    }
+    if (i != CQ_HEAD)
+        return false;
+
+    i = cq_last(cq);
+    for (struct list_head *node = head->prev; node != head; node = node->prev) {
+        e = list_entry(node, element_t, list);
+        if (i == CQ_HEAD || strcmp(e->value, cq_value(cq, i)))
+            return false;
+        i = cq_prev(cq, i);
+    }
+    if (i != CQ_HEAD)
+        return false;
+
+    size_t used, reserved = cq_footprint(cq, &used);
+    return used <= reserved;
+}
+
+/* Remove from the head or the tail of both queues and compare the strings
+ * copied out, truncated to a random buffer size or not copied at all
+ */
+static bool check_remove(struct list_head *head, cqueue_t *cq, bool tail)
+{
+    char qbuf[MAX_BUF], cqbuf[MAX_BUF];
+    size_t bufsize = 1 + pick(MAX_BUF);
+    bool copy = pick(4);
+
+    memset(qbuf, 'x', sizeof(qbuf));
+    memset(cqbuf, 'x', sizeof(cqbuf));
+    element_t *e = tail ? q_remove_tail(head, copy ? qbuf : NULL, bufsize)
+                        : q_remove_head(head, copy ? qbuf : NULL, bufsize);
+    bool ok = tail ? cq_remove_tail(cq, copy ? cqbuf : NULL, bufsize)
+                   : cq_remove_head(cq, copy ? cqbuf : NULL, bufsize);
+    if (e)
+        q_release_element(e);
+    return !e == !ok && (!copy || !e || !strcmp(qbuf, cqbuf));
+}
+
+/* Merge two fresh sorted queues into both sides, which are sorted first */
+static bool check_merge(struct list_head *head, cqueue_t *cq)
+{
+    bool descend = pick(2);
+    struct list_head *other = q_new();
+    cqueue_t *cq_other = cq_new();
+    if (!other || !cq_other) {
+        q_free(other);
+        cq_free(cq_other);
+        return false;
+    }
+
+    char key[MAX_KEY + 1];
+    for (size_t n = pick(64); n; n--) {
+        random_key(key);
+        if (!q_insert_tail(other, key) || !cq_insert_tail(cq_other, key)) {
+            q_free(other);
+            cq_free(cq_other);
+            return false;
+        }
+    }
+    q_sort(head, descend);
+    q_sort(other, descend);
+
+    queue_contex_t first = {.q = head, .size = q_size(head), .id = 0};
+    queue_contex_t second = {.q = other, .size = q_size(other), .id = 1};
+    struct list_head chain;
+    INIT_LIST_HEAD(&chain);
+    list_add_tail(&first.chain, &chain);
+    list_add_tail(&second.chain, &chain);
+
+    int n = q_merge(&chain, descend);
+    int cq_n = cq_merge(cq, cq_other, descend);
+    bool ok = n == cq_n && q_size(other) == 0 && cq_size(cq_other) == 0;
+    q_free(other);
+    cq_free(cq_other);
+    return ok;
+}
+
+static const char *const op_names[] = {
+    "insert_head", "insert_tail", "remove_head", "remove_tail", "delete_mid",
+    "delete_dup",  "swap",        "reverse",     "reverseK",    "sort",
+    "ascend",      "descend",     "merge",
+};
+
+#define N_OPS (sizeof(op_names) / sizeof(op_names[0]))
+
+/* Apply operation @op to both queues, return whether they agreed */
+static bool step(struct list_head *head, cqueue_t *cq, size_t op)
+{
+    char key[MAX_KEY + 1];
+    bool descend;
+    int k;
+
+    switch (op) {
+    case 0:
+    case 1:
+        random_key(key);
+        if (op == 0)
+            return q_insert_head(head, key) == cq_insert_head(cq, key);
+        return q_insert_tail(head, key) == cq_insert_tail(cq, key);
+    case 2:
+    case 3:
+        return check_remove(head, cq, op == 3);
+    case 4:
+        return q_delete_mid(head) == cq_delete_mid(cq);
+    case 5:
+        /* Sorted queues are where duplicates end up adjacent */
+        if (pick(2)) {
+            q_sort(head, false);
+            cq_sort(cq, false);
+        }
+        return q_delete_dup(head) == cq_delete_dup(cq);
+    case 6:
+        q_swap(head);
+        cq_swap(cq);
+        return true;
+    case 7:
+        q_reverse(head);
+        cq_reverse(cq);
+        return true;
+    case 8:
+        k = 1 + pick(6);
+        q_reverseK(head, k);
+        cq_reverseK(cq, k);
+        return true;
+    case 9:
+        descend = pick(2);
+        q_sort(head, descend);
+        cq_sort(cq, descend);
+        return true;
+    case 10:
+        return q_ascend(head) == cq_ascend(cq);
+    case 11:
+        return q_descend(head) == cq_descend(cq);
+    default:
+        return check_merge(head, cq);
+    }
+}
+
+/* Insertions outweigh removals slightly so that queues grow over a round */
+static size_t pick_op(void)
+{
+    size_t r = pick(32);
+    if (r < 8)
+        return r % 2;
+    if (r < 14)
+        return 2 + r % 2;
+    return 4 + (r - 14) % (N_OPS - 4);
+}
+
+static bool run_round(uint64_t seed, int ops)
+{
+    state = seed ? seed : 1;
+    struct list_head *head = q_new();
+    cqueue_t *cq = cq_new();
+    bool ok = head && cq;
+
+    for (int i = 0; ok && i < ops; i++) {
+        size_t op = pick_op();
+        if (!step(head, cq, op) || !same_contents(head, cq)) {
+            printf("Mismatch after %s, operation %d of the round with seed "
+                   "%#llx\n",
+                   op_names[op], i + 1, (unsigned long long) seed);
+            ok = false;
+        }
+    }
+
+    q_free(head);
+    cq_free(cq);
+    return ok;
+}
+
+static void usage(const char *cmd)
+{
+    printf("Usage: %s [-h] [-r ROUNDS] [-l OPS] [-s SEED]\n", cmd);
+    printf("\t-h        Print this information\n");
+    printf("\t-r ROUNDS Number of rounds, each on fresh queues (default %d)\n",
+           DEFAULT_ROUNDS);
+    printf("\t-l OPS    Operations per round (default %d)\n", DEFAULT_OPS);
+    printf("\t-s SEED   Seed of the first round (default 1)\n");
+    exit(0);
+}
+
+int main(int argc, char *argv[])
+{
+    int rounds = DEFAULT_ROUNDS, ops = DEFAULT_OPS;
+    uint64_t seed = 1;
+    int c;
+
+    while ((c = getopt(argc, argv, "hr:l:s:")) != -1) {
+        switch (c) {
+        case 'h':
+            usage(argv[0]);
+            break;
+        case 'r':
+            rounds = atoi(optarg);
+            break;
+        case 'l':
+            ops = atoi(optarg);
+            break;
+        case 's':
+            seed = strtoull(optarg, NULL, 0);
+            break;
+        default:
+            printf("Unknown option '%c'\n", c);
+            usage(argv[0]);
+        }
+    }
+
+    for (int r = 0; r < rounds; r++) {
+        if (!run_round(seed + r, ops))
+            return 1;
+    }
+    printf("%d rounds of %d operations: compact queue matches queue.c\n",
+           rounds, ops);
+    return 0;
+}
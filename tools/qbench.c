@@ -0,0 +1,1069 @@
+/* Micro-benchmarks for the queue implementation
+ *
+ * queue.c is linked against plain allocation wrappers instead of the test
+ * harness, so the numbers reflect the queue code itself rather than the
+ * bookkeeping done by qtest (block headers, cautious-mode list walks, ...).
+ *
+ * Usage: qbench [-h] [-n SIZE]... [-r REPS] [BENCH]...
+ *        qbench -c [-r REPS] [OP]...
+ *        qbench -s [-n SIZE]... [-r REPS] [-j FILE] [WORKLOAD]...
+ *
+ * With -c, each operation is timed on queues of 2^10 to 2^18 nodes, and the
+ * exponent of the power of n its timings grow as is fitted on a log-log scale.
+ * The exit status is nonzero when an operation grows faster than the degree it
+ * should have, e.g. quadratically where a linear pass is expected, or when its
+ * timings are too noisy to tell.
+ *
+ * With -s, a fixed set of workloads (insertion, removal, sorting of random,
+ * sorted, reversed and duplicate-heavy keys, merging, q_reverseK and
+ * q_delete_dup) is timed at several sizes and every repetition is written to
+ * the JSON file given with -j, for scripts/bench-compare.py to check against a
+ * baseline.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* The benchmark needs to use regular malloc/free */
+#define INTERNAL 1
+#include "harness.h"
+#include "list_sort.h"
+#include "queue.h"
+
+/* Allocation hooks normally provided by harness.c */
+
+void *test_malloc(size_t size)
+{
+    return malloc(size);
+}
+
+void *test_calloc(size_t nelem, size_t elsize)
+{
+    return calloc(nelem, elsize);
+}
+
+void test_free(void *p)
+{
+    free(p);
+}
+
+char *test_strdup(const char *s)
+{
+    return strdup(s);
+}
+
+#define MAX_SIZES 8
+#define DEFAULT_REPS 5
+
+static size_t sizes[MAX_SIZES] = {1000000, 10000000};
+static int n_sizes = 2;
+static int reps = DEFAULT_REPS;
+
+static inline uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static struct list_head *build_queue(size_t n)
+{
+    struct list_head *head = q_new();
+    if (!head)
+        return NULL;
+
+    char buf[32];
+    for (size_t i = 0; i < n; i++) {
+        snprintf(buf, sizeof(buf), "%zx", i);
+        if (!q_insert_tail(head, buf)) {
+            q_free(head);
+            return NULL;
+        }
+    }
+    return head;
+}
+
+/* Queue of @n random @len-letter strings drawn from the first @letters
+ * letters, reproducible from @seed
+ */
+static struct list_head *build_seeded_queue(size_t n,
+                                            uint64_t seed,
+                                            int len,
+                                            int letters)
+{
+    struct list_head *head = q_new();
+    if (!head)
+        return NULL;
+
+    uint64_t x = seed;
+    char buf[9] = {0};
+    for (size_t i = 0; i < n; i++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        for (int c = 0; c < len; c++)
+            buf[c] = 'a' + ((x >> (c * 8)) & 0xff) % letters;
+        if (!q_insert_tail(head, buf)) {
+            q_free(head);
+            return NULL;
+        }
+    }
+    return head;
+}
+
+/* Queue of @n random 8-letter strings, reproducible from run to run */
+static struct list_head *build_random_queue(size_t n)
+{
+    return build_seeded_queue(n, 0x2545f4914f6cdd1dULL, 8, 26);
+}
+
+/* Relink the nodes of @head in a random order, so that successive nodes are
+ * scattered across memory and every step of a traversal is a cache miss once
+ * the queue outgrows the last-level cache.
+ */
+static bool scatter_queue(struct list_head *head, size_t n)
+{
+    struct list_head **nodes = malloc(n * sizeof(*nodes));
+    if (!nodes)
+        return false;
+
+    size_t cnt = 0;
+    struct list_head *node;
+    list_for_each(node, head)
+        nodes[cnt++] = node;
+
+    uint64_t x = 0x9e3779b97f4a7c15ULL;
+    for (size_t i = cnt - 1; i > 0; i--) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        size_t j = x % (i + 1);
+        struct list_head *tmp = nodes[i];
+        nodes[i] = nodes[j];
+        nodes[j] = tmp;
+    }
+
+    INIT_LIST_HEAD(head);
+    for (size_t i = 0; i < cnt; i++)
+        list_add_tail(nodes[i], head);
+
+    free(nodes);
+    return true;
+}
+
+/* Reversal as it was done before q_reverse() swapped links in place */
+static void ref_reverse(struct list_head *head)
+{
+    struct list_head *node, *safe;
+    list_for_each_safe(node, safe, head)
+        list_move(node, head);
+}
+
+/* Traversals with and without the prefetching iterators of list.h. The
+ * results go to a volatile sink so the loops are not optimized away.
+ */
+static volatile size_t sink;
+
+static void walk_plain(struct list_head *head)
+{
+    size_t cnt = 0;
+    struct list_head *node;
+    list_for_each(node, head)
+        cnt++;
+    sink = cnt;
+}
+
+static void walk_prefetch(struct list_head *head)
+{
+    sink = q_size(head);
+}
+
+static void strlen_plain(struct list_head *head)
+{
+    size_t len = 0;
+    element_t *e;
+    list_for_each_entry(e, head, list)
+        len += strlen(e->value);
+    sink = len;
+}
+
+static void strlen_prefetch(struct list_head *head)
+{
+    size_t len = 0;
+    element_t *e;
+    list_for_each_entry_prefetch(e, head, list)
+        len += strlen(e->value);
+    sink = len;
+}
+
+static int cmp_value(void *priv, const struct list_head *a,
+                     const struct list_head *b)
+{
+    return strcmp(list_entry(a, element_t, list)->value,
+                  list_entry(b, element_t, list)->value);
+}
+
+static void sort_callback(struct list_head *head)
+{
+    list_sort(NULL, head, cmp_value);
+}
+
+static void sort_ascend(struct list_head *head)
+{
+    q_sort(head, false);
+}
+
+static void sort_descend(struct list_head *head)
+{
+    q_sort(head, true);
+}
+
+typedef void (*list_op_t)(struct list_head *head);
+
+/* Flags describing the queue an operation is timed on */
+#define Q_RANDOM 1  /* random keys instead of increasing ones */
+#define Q_SCATTER 2 /* nodes linked in random memory order */
+#define Q_RESTORE 4 /* relink nodes in their initial order before each run */
+
+static void relink(struct list_head *head, struct list_head **nodes, size_t n)
+{
+    INIT_LIST_HEAD(head);
+    for (size_t i = 0; i < n; i++)
+        list_add_tail(nodes[i], head);
+}
+
+typedef struct {
+    const char *name;
+    list_op_t op;
+} variant_t;
+
+#define TIME_OPS(n, flags, ...)                                          \
+    time_ops((variant_t[]){__VA_ARGS__},                                 \
+             sizeof((variant_t[]){__VA_ARGS__}) / sizeof(variant_t), n, \
+             flags)
+
+/* Run each variant @reps times on the same queue of @n nodes and report the
+ * best ns/node. Sharing the queue keeps the memory layout identical across
+ * variants, which otherwise skews the comparison.
+ */
+static bool time_ops(const variant_t *variants, size_t n_variants, size_t n,
+                     int flags)
+{
+    struct list_head *head =
+        flags & Q_RANDOM ? build_random_queue(n) : build_queue(n);
+    struct list_head **nodes = NULL;
+    bool ok = head && (!(flags & Q_SCATTER) || scatter_queue(head, n));
+
+    if (ok && (flags & Q_RESTORE)) {
+        nodes = malloc(n * sizeof(*nodes));
+        ok = nodes;
+        if (ok) {
+            size_t i = 0;
+            struct list_head *node;
+            list_for_each(node, head)
+                nodes[i++] = node;
+        }
+    }
+
+    if (!ok) {
+        fprintf(stderr, "%s: could not build queue of %zu nodes\n",
+                variants[0].name, n);
+        if (head)
+            q_free(head);
+        return false;
+    }
+
+    for (size_t v = 0; v < n_variants; v++) {
+        /* Warm up caches and TLB once before measuring */
+        if (nodes)
+            relink(head, nodes, n);
+        variants[v].op(head);
+
+        uint64_t best = UINT64_MAX, total = 0;
+        for (int r = 0; r < reps; r++) {
+            if (nodes)
+                relink(head, nodes, n);
+            uint64_t start = now_ns();
+            variants[v].op(head);
+            uint64_t elapsed = now_ns() - start;
+            total += elapsed;
+            if (elapsed < best)
+                best = elapsed;
+        }
+
+        printf("%-14s n=%-10zu min %7.2f ns/node, avg %7.2f ns/node\n",
+               variants[v].name, n, (double) best / n,
+               (double) total / reps / n);
+    }
+
+    free(nodes);
+    q_free(head);
+    return true;
+}
+
+static bool bench_reverse(size_t n)
+{
+    return TIME_OPS(n, 0, {"reverse", q_reverse},
+                    {"reverse(move)", ref_reverse});
+}
+
+static bool bench_swap(size_t n)
+{
+    return TIME_OPS(n, 0, {"swap", q_swap});
+}
+
+static bool bench_sort(size_t n)
+{
+    return TIME_OPS(n, Q_RANDOM | Q_RESTORE, {"sort", sort_ascend},
+                    {"sort(desc)", sort_descend}, {"sort(cb)", sort_callback});
+}
+
+static bool bench_walk(size_t n)
+{
+    return TIME_OPS(n, Q_SCATTER, {"walk", walk_plain},
+                    {"walk(pf)", walk_prefetch}, {"strlen", strlen_plain},
+                    {"strlen(pf)", strlen_prefetch});
+}
+
+typedef struct {
+    const char *name;
+    bool (*run)(size_t n);
+    const char *summary;
+} bench_t;
+
+static const bench_t benches[] = {
+    {"reverse", bench_reverse, "q_reverse vs. per-node list_move"},
+    {"swap", bench_swap, "q_swap"},
+    {"sort", bench_sort, "q_sort vs. list_sort with a callback"},
+    {"walk", bench_walk, "Traversals of scattered nodes with/without prefetch"},
+};
+
+#define N_BENCHES (sizeof(benches) / sizeof(benches[0]))
+
+/* Complexity classes the operations are expected to have. Only the degree of
+ * the polynomial is checked: a logarithmic factor changes the growth as much
+ * as the caches do, so O(n) and O(n log n) cannot be told apart reliably.
+ */
+typedef enum { O_1, O_LOGN, O_N, O_NLOGN, O_N2, N_CLASSES } bigo_t;
+
+static const char *const bigo_names[] = {"O(1)", "O(log n)", "O(n)",
+                                         "O(n log n)", "O(n^2)"};
+static const int bigo_degree[] = {0, 0, 1, 1, 2};
+
+/* Sizes the estimator times, growing by a factor of two */
+#define COMPLEXITY_MIN_SIZE 1024
+#define COMPLEXITY_MAX_SIZE (1 << 18)
+#define N_COMPLEXITY_SIZES 9
+
+/* Fit log(t / cost) = a + slope * log n by least squares and return the
+ * slope, with its standard error in @se. @cost is the time per node of a plain
+ * traversal of each queue: any access gets slower as the queue outgrows each
+ * cache level, which on its own would steepen the growth.
+ */
+static double loglog_fit(const size_t *n,
+                         const double *t,
+                         const double *cost,
+                         int cnt,
+                         double *se)
+{
+    double x[N_COMPLEXITY_SIZES], y[N_COMPLEXITY_SIZES];
+    double mx = 0, my = 0;
+    for (int i = 0; i < cnt; i++) {
+        x[i] = log2(n[i]);
+        y[i] = log2(t[i] / cost[i]);
+        mx += x[i];
+        my += y[i];
+    }
+    mx /= cnt;
+    my /= cnt;
+
+    double sxx = 0, sxy = 0;
+    for (int i = 0; i < cnt; i++) {
+        sxx += (x[i] - mx) * (x[i] - mx);
+        sxy += (x[i] - mx) * (y[i] - my);
+    }
+    double slope = sxy / sxx, rss = 0;
+    for (int i = 0; i < cnt; i++) {
+        double r = y[i] - my - slope * (x[i] - mx);
+        rss += r * r;
+    }
+    *se = sqrt(rss / (cnt - 2) / sxx);
+    return slope;
+}
+
+/* Queue operations timed by the estimator. Each runs on a queue of n nodes
+ * and returns how many calls it made, so cheap operations can be batched.
+ */
+#define CALL_BATCH 256
+
+static size_t op_size(struct list_head *head, size_t n)
+{
+    sink = q_size(head);
+    return 1;
+}
+
+static size_t op_insert_head(struct list_head *head, size_t n)
+{
+    for (int i = 0; i < CALL_BATCH; i++)
+        q_insert_head(head, "insert");
+    return CALL_BATCH;
+}
+
+static size_t op_insert_tail(struct list_head *head, size_t n)
+{
+    for (int i = 0; i < CALL_BATCH; i++)
+        q_insert_tail(head, "insert");
+    return CALL_BATCH;
+}
+
+static size_t op_remove_head(struct list_head *head, size_t n)
+{
+    size_t calls = n < CALL_BATCH ? n : CALL_BATCH;
+    for (size_t i = 0; i < calls; i++)
+        q_release_element(q_remove_head(head, NULL, 0));
+    return calls;
+}
+
+static size_t op_remove_tail(struct list_head *head, size_t n)
+{
+    size_t calls = n < CALL_BATCH ? n : CALL_BATCH;
+    for (size_t i = 0; i < calls; i++)
+        q_release_element(q_remove_tail(head, NULL, 0));
+    return calls;
+}
+
+static size_t op_reverse(struct list_head *head, size_t n)
+{
+    q_reverse(head);
+    return 1;
+}
+
+static size_t op_reverseK(struct list_head *head, size_t n)
+{
+    q_reverseK(head, 3);
+    return 1;
+}
+
+static size_t op_sort(struct list_head *head, size_t n)
+{
+    q_sort(head, false);
+    return 1;
+}
+
+static size_t op_delete_mid(struct list_head *head, size_t n)
+{
+    for (int i = 0; i < 8; i++)
+        q_delete_mid(head);
+    return 8;
+}
+
+static size_t op_delete_dup(struct list_head *head, size_t n)
+{
+    q_delete_dup(head);
+    return 1;
+}
+
+static size_t op_ascend(struct list_head *head, size_t n)
+{
+    q_ascend(head);
+    return 1;
+}
+
+static size_t op_descend(struct list_head *head, size_t n)
+{
+    q_descend(head);
+    return 1;
+}
+
+/* @head is a chain of queue contexts, see Q_CHAIN */
+static size_t op_merge(struct list_head *head, size_t n)
+{
+    q_merge(head, false);
+    return 1;
+}
+
+/* Further flags describing the queue an operation runs on */
+#define Q_DUPS 8   /* every key appears twice in a row */
+#define Q_CHAIN 16 /* two random queues of n / 2 nodes chained for q_merge */
+
+typedef struct {
+    const char *name;
+    size_t (*op)(struct list_head *head, size_t n);
+    int flags;
+    bigo_t expect;
+} complexity_op_t;
+
+static const complexity_op_t complexity_ops[] = {
+    {"size", op_size, 0, O_N},
+    {"insert_head", op_insert_head, 0, O_1},
+    {"insert_tail", op_insert_tail, 0, O_1},
+    {"remove_head", op_remove_head, 0, O_1},
+    {"remove_tail", op_remove_tail, 0, O_1},
+    {"reverse", op_reverse, 0, O_N},
+    {"reverseK", op_reverseK, 0, O_N},
+    {"sort", op_sort, Q_RANDOM, O_NLOGN},
+    {"delete_mid", op_delete_mid, 0, O_N},
+    {"delete_dup", op_delete_dup, Q_DUPS, O_N},
+    {"ascend", op_ascend, Q_RANDOM, O_N},
+    {"descend", op_descend, Q_RANDOM, O_N},
+    {"merge", op_merge, Q_CHAIN, O_NLOGN},
+};
+
+#define N_COMPLEXITY_OPS (sizeof(complexity_ops) / sizeof(complexity_ops[0]))
+
+/* Stop growing once a single call takes this long, so that a quadratic
+ * operation does not stall the run
+ */
+#define COMPLEXITY_BUDGET_NS 200000000ULL
+
+/* Fewer sizes than this leave the fit meaningless */
+#define COMPLEXITY_MIN_POINTS 4
+
+/* Timings of a single call are noisy, keep the best of this many by default */
+#define COMPLEXITY_REPS 15
+
+/* An operation fails when its timings grow faster than n^(d + 0.5), d being
+ * the degree it is expected to have. The slope has to clear that bound by
+ * this many standard errors either way; otherwise the timings are too noisy
+ * to tell, which fails as well since nothing was shown.
+ */
+#define COMPLEXITY_SLOPE_MARGIN 3
+
+static struct list_head *build_dup_queue(size_t n)
+{
+    struct list_head *head = q_new();
+    if (!head)
+        return NULL;
+
+    char buf[32];
+    for (size_t i = 0; i < n; i++) {
+        snprintf(buf, sizeof(buf), "%zx", i / 2);
+        if (!q_insert_tail(head, buf)) {
+            q_free(head);
+            return NULL;
+        }
+    }
+    return head;
+}
+
+static void free_chain(struct list_head *chain)
+{
+    queue_contex_t *ctx, *safe;
+    list_for_each_entry_safe(ctx, safe, chain, chain) {
+        q_free(ctx->q);
+        free(ctx);
+    }
+    free(chain);
+}
+
+/* Chain of @k sorted random queues sharing @n nodes, for q_merge() */
+static struct list_head *build_chain(size_t n, int k)
+{
+    struct list_head *chain = malloc(sizeof(*chain));
+    if (!chain)
+        return NULL;
+    INIT_LIST_HEAD(chain);
+
+    for (int i = 0; i < k; i++) {
+        queue_contex_t *ctx = malloc(sizeof(*ctx));
+        if (!ctx ||
+            !(ctx->q = build_seeded_queue(
+                  n / k, 0x2545f4914f6cdd1dULL * (i + 1), 8, 26))) {
+            free(ctx);
+            free_chain(chain);
+            return NULL;
+        }
+        /* Queues are sorted before q_merge() is called on them */
+        q_sort(ctx->q, false);
+        ctx->size = n / k;
+        ctx->id = i;
+        list_add_tail(&ctx->chain, chain);
+    }
+    return chain;
+}
+
+/* Best ns per call of @op on a queue of @n nodes, 0 on allocation failure.
+ * The best ns per node of a plain traversal of the same queues is stored in
+ * @cost, so that it reflects how their nodes are laid out in memory.
+ */
+static double time_call(const complexity_op_t *op, size_t n, double *cost)
+{
+    double best = 0;
+    *cost = 0;
+    for (int r = 0; r < reps; r++) {
+        struct list_head *head;
+        if (op->flags & Q_CHAIN)
+            head = build_chain(n, 2);
+        else if (op->flags & Q_DUPS)
+            head = build_dup_queue(n);
+        else
+            head = op->flags & Q_RANDOM ? build_random_queue(n) : build_queue(n);
+        if (!head)
+            return 0;
+
+        uint64_t start = now_ns();
+        if (op->flags & Q_CHAIN) {
+            queue_contex_t *ctx;
+            list_for_each_entry(ctx, head, chain)
+                walk_plain(ctx->q);
+        } else
+            walk_plain(head);
+        double elapsed = (double) (now_ns() - start) / n;
+        if (!*cost || elapsed < *cost)
+            *cost = elapsed;
+
+        start = now_ns();
+        size_t calls = op->op(head, n);
+        elapsed = (double) (now_ns() - start) / calls;
+        if (!best || elapsed < best)
+            best = elapsed;
+
+        if (op->flags & Q_CHAIN)
+            free_chain(head);
+        else
+            q_free(head);
+    }
+    return best;
+}
+
+/* Time @op on growing queues and report how fast the timings grow. Return
+ * false when they grow faster than expected, or too erratically to tell.
+ */
+static bool estimate_complexity(const complexity_op_t *op)
+{
+    size_t n[N_COMPLEXITY_SIZES];
+    double t[N_COMPLEXITY_SIZES], cost[N_COMPLEXITY_SIZES];
+    int cnt = 0;
+
+    for (size_t size = COMPLEXITY_MIN_SIZE; size <= COMPLEXITY_MAX_SIZE;
+         size *= 2) {
+        double ns = time_call(op, size, &cost[cnt]);
+        if (ns <= 0) {
+            fprintf(stderr, "%s: could not build queue of %zu nodes\n",
+                    op->name, size);
+            return false;
+        }
+        n[cnt] = size;
+        t[cnt++] = ns;
+        if (ns > COMPLEXITY_BUDGET_NS)
+            break;
+    }
+
+    if (cnt < COMPLEXITY_MIN_POINTS) {
+        printf("%-12s too slow to estimate (%.0f ns per call at n=%zu)\n",
+               op->name, t[cnt - 1], n[cnt - 1]);
+        return false;
+    }
+
+    double se, slope = loglog_fit(n, t, cost, cnt, &se);
+    double bound = bigo_degree[op->expect] + 0.5;
+    bool too_slow = slope - COMPLEXITY_SLOPE_MARGIN * se > bound;
+    bool unsure = !too_slow && slope + COMPLEXITY_SLOPE_MARGIN * se > bound;
+
+    printf("%-12s grows as n^%5.2f +- %4.2f, expected %-10s %s\n", op->name,
+           slope, se, bigo_names[op->expect],
+           too_slow ? "TOO SLOW" : unsure ? "inconclusive" : "ok");
+    return !too_slow && !unsure;
+}
+
+/* Estimate the operations named in @names, all of them if @n_names is 0 */
+static bool run_complexity(char *names[], int n_names)
+{
+    for (int j = 0; j < n_names; j++) {
+        size_t i = 0;
+        while (i < N_COMPLEXITY_OPS && strcmp(names[j], complexity_ops[i].name))
+            i++;
+        if (i == N_COMPLEXITY_OPS) {
+            fprintf(stderr, "Unknown operation '%s'\n", names[j]);
+            return false;
+        }
+    }
+
+    bool ok = true;
+    for (size_t i = 0; i < N_COMPLEXITY_OPS; i++) {
+        bool selected = !n_names;
+        for (int j = 0; j < n_names && !selected; j++)
+            selected = !strcmp(names[j], complexity_ops[i].name);
+        if (selected)
+            ok = estimate_complexity(&complexity_ops[i]) && ok;
+    }
+    return ok;
+}
+
+/* Regression suite: fixed workloads timed at several sizes, with every
+ * repetition kept so that scripts/bench-compare.py can tell a slowdown
+ * between two builds apart from noise.
+ */
+#define SUITE_REPS 20
+
+/* Below these sizes a run lasts a few microseconds, within the reach of timer
+ * and scheduling noise
+ */
+static const size_t suite_sizes[] = {1 << 15, 1 << 18};
+
+/* Data a workload runs on */
+typedef enum {
+    DATA_EMPTY,    /* empty queue */
+    DATA_SEQ,      /* increasing hexadecimal keys, see build_queue() */
+    DATA_RANDOM,   /* random 8-letter keys */
+    DATA_SORTED,   /* keys in ascending order */
+    DATA_REVERSED, /* keys in descending order */
+    DATA_FEW,      /* random keys with only 16 distinct values */
+    DATA_DUPS,     /* every key appears twice in a row */
+    DATA_CHAIN,    /* eight sorted random queues chained for q_merge() */
+} data_t;
+
+/* Queue of @n fixed-width keys sorted in ascending or descending order */
+static struct list_head *build_ordered_queue(size_t n, bool descend)
+{
+    struct list_head *head = q_new();
+    if (!head)
+        return NULL;
+
+    char buf[32];
+    for (size_t i = 0; i < n; i++) {
+        snprintf(buf, sizeof(buf), "%016zx", descend ? n - 1 - i : i);
+        if (!q_insert_tail(head, buf)) {
+            q_free(head);
+            return NULL;
+        }
+    }
+    return head;
+}
+
+static struct list_head *build_data(data_t data, size_t n)
+{
+    switch (data) {
+    case DATA_EMPTY:
+        return q_new();
+    case DATA_SEQ:
+        return build_queue(n);
+    case DATA_RANDOM:
+        return build_random_queue(n);
+    case DATA_SORTED:
+        return build_ordered_queue(n, false);
+    case DATA_REVERSED:
+        return build_ordered_queue(n, true);
+    case DATA_FEW:
+        return build_seeded_queue(n, 0x2545f4914f6cdd1dULL, 2, 4);
+    case DATA_DUPS:
+        return build_dup_queue(n);
+    default:
+        return build_chain(n, 8);
+    }
+}
+
+static void run_insert_head(struct list_head *head, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        q_insert_head(head, "benchmark");
+}
+
+static void run_insert_tail(struct list_head *head, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        q_insert_tail(head, "benchmark");
+}
+
+static void run_remove_head(struct list_head *head, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        q_release_element(q_remove_head(head, NULL, 0));
+}
+
+static void run_remove_tail(struct list_head *head, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        q_release_element(q_remove_tail(head, NULL, 0));
+}
+
+static void run_sort(struct list_head *head, size_t n)
+{
+    q_sort(head, false);
+}
+
+static void run_merge(struct list_head *head, size_t n)
+{
+    q_merge(head, false);
+}
+
+static void run_reverseK(struct list_head *head, size_t n)
+{
+    q_reverseK(head, 8);
+}
+
+static void run_delete_dup(struct list_head *head, size_t n)
+{
+    q_delete_dup(head);
+}
+
+typedef struct {
+    const char *name;
+    void (*run)(struct list_head *head, size_t n);
+    data_t data;
+} workload_t;
+
+static const workload_t workloads[] = {
+    {"insert_head", run_insert_head, DATA_EMPTY},
+    {"insert_tail", run_insert_tail, DATA_EMPTY},
+    {"remove_head", run_remove_head, DATA_SEQ},
+    {"remove_tail", run_remove_tail, DATA_SEQ},
+    {"sort_random", run_sort, DATA_RANDOM},
+    {"sort_sorted", run_sort, DATA_SORTED},
+    {"sort_reversed", run_sort, DATA_REVERSED},
+    {"sort_dups", run_sort, DATA_FEW},
+    {"merge_8", run_merge, DATA_CHAIN},
+    {"reverseK_8", run_reverseK, DATA_SEQ},
+    {"delete_dup", run_delete_dup, DATA_DUPS},
+};
+
+#define N_WORKLOADS (sizeof(workloads) / sizeof(workloads[0]))
+
+/* Time @w on a freshly built queue of @n nodes, in ns per node, or return a
+ * negative value when the queue cannot be built. Building and freeing the
+ * queue stay out of the timed region.
+ */
+static double time_workload(const workload_t *w, size_t n)
+{
+    struct list_head *head = build_data(w->data, n);
+    if (!head)
+        return -1;
+
+    uint64_t start = now_ns();
+    w->run(head, n);
+    double elapsed = (double) (now_ns() - start) / n;
+
+    if (w->data == DATA_CHAIN)
+        free_chain(head);
+    else
+        q_free(head);
+    return elapsed;
+}
+
+/* Run the workloads named in @names, all of them if @n_names is 0, and write
+ * the samples as JSON to @path unless it is NULL. Repetitions go round all
+ * workloads in turn, so that a machine getting slower or faster over the run
+ * spreads the samples of each workload rather than shifting some of them.
+ */
+static bool run_suite(char *names[], int n_names, const char *path)
+{
+    const workload_t *selected[N_WORKLOADS];
+    size_t n_selected = 0;
+
+    for (size_t i = 0; i < N_WORKLOADS; i++) {
+        bool found = !n_names;
+        for (int j = 0; j < n_names && !found; j++)
+            found = !strcmp(names[j], workloads[i].name);
+        if (found)
+            selected[n_selected++] = &workloads[i];
+    }
+    for (int j = 0; j < n_names; j++) {
+        size_t i = 0;
+        while (i < N_WORKLOADS && strcmp(names[j], workloads[i].name))
+            i++;
+        if (i == N_WORKLOADS) {
+            fprintf(stderr, "Unknown workload '%s'\n", names[j]);
+            return false;
+        }
+    }
+
+    size_t n_cases = n_selected * n_sizes;
+    double *samples = malloc(n_cases * reps * sizeof(*samples));
+    if (!samples)
+        return false;
+
+    /* The first round only warms up caches and the allocator */
+    bool ok = true;
+    for (int r = -1; r < reps && ok; r++) {
+        for (size_t c = 0; c < n_cases && ok; c++) {
+            const workload_t *w = selected[c / n_sizes];
+            size_t n = sizes[c % n_sizes];
+            double ns = time_workload(w, n);
+            if (ns < 0) {
+                fprintf(stderr, "%s: could not build queue of %zu nodes\n",
+                        w->name, n);
+                ok = false;
+            } else if (r >= 0) {
+                samples[c * reps + r] = ns;
+            }
+        }
+    }
+
+    FILE *out = NULL;
+    if (ok && path && !(out = fopen(path, "w"))) {
+        fprintf(stderr, "Cannot open '%s': %s\n", path, strerror(errno));
+        ok = false;
+    }
+    if (out)
+        fprintf(out, "{\n  \"reps\": %d,\n  \"results\": [", reps);
+
+    for (size_t c = 0; c < n_cases && ok; c++) {
+        const workload_t *w = selected[c / n_sizes];
+        size_t n = sizes[c % n_sizes];
+        const double *x = &samples[c * reps];
+
+        double sum = 0, best = x[0];
+        for (int r = 0; r < reps; r++) {
+            sum += x[r];
+            if (x[r] < best)
+                best = x[r];
+        }
+        double mean = sum / reps, var = 0;
+        for (int r = 0; r < reps; r++)
+            var += (x[r] - mean) * (x[r] - mean);
+        double sd = reps > 1 ? sqrt(var / (reps - 1)) : 0;
+
+        printf("%-14s n=%-10zu min %7.2f ns/node, avg %7.2f ns/node, "
+               "sd %5.1f%%\n",
+               w->name, n, best, mean, 100 * sd / mean);
+
+        if (!out)
+            continue;
+        fprintf(out,
+                "%s\n    {\"name\": \"%s\", \"n\": %zu, \"min\": %.4f, "
+                "\"mean\": %.4f, \"sd\": %.4f, \"samples\": [",
+                c ? "," : "", w->name, n, best, mean, sd);
+        for (int r = 0; r < reps; r++)
+            fprintf(out, "%s%.4f", r ? ", " : "", x[r]);
+        fprintf(out, "]}");
+    }
+
+    free(samples);
+    if (out) {
+        fprintf(out, "\n  ]\n}\n");
+        if (fclose(out)) {
+            fprintf(stderr, "Cannot write '%s': %s\n", path, strerror(errno));
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+static void usage(const char *cmd)
+{
+    printf("Usage: %s [-h] [-n SIZE]... [-r REPS] [BENCH]...\n", cmd);
+    printf("       %s -c [-r REPS] [OP]...\n", cmd);
+    printf("       %s -s [-n SIZE]... [-r REPS] [-j FILE] [WORKLOAD]...\n", cmd);
+    printf("\t-h        Print this information\n");
+    printf("\t-c        Check how the cost of queue operations grows\n");
+    printf("\t-s        Run the regression suite (default sizes 32K and 256K, "
+           "%d reps)\n",
+           SUITE_REPS);
+    printf("\t-j FILE   Write the samples of -s as JSON to FILE\n");
+    printf("\t-n SIZE   Queue size to test (repeatable, default 1M and 10M)\n");
+    printf("\t-r REPS   Timed repetitions per size (default %d, %d with -c)\n",
+           DEFAULT_REPS, COMPLEXITY_REPS);
+    printf("Benchmarks (default: all):\n");
+    for (size_t i = 0; i < N_BENCHES; i++)
+        printf("\t%-10s%s\n", benches[i].name, benches[i].summary);
+    printf("Operations for -c (default: all):\n\t");
+    for (size_t i = 0; i < N_COMPLEXITY_OPS; i++)
+        printf("%s%s", complexity_ops[i].name,
+               i + 1 < N_COMPLEXITY_OPS ? " " : "\n");
+    printf("Workloads for -s (default: all):\n\t");
+    for (size_t i = 0; i < N_WORKLOADS; i++)
+        printf("%s%s", workloads[i].name, i + 1 < N_WORKLOADS ? " " : "\n");
+    exit(0);
+}
+
+static bool parse_size(const char *arg, size_t *val)
+{
+    char *end;
+    errno = 0;
+    unsigned long long v = strtoull(arg, &end, 0);
+    if (errno || end == arg || *end != '\0' || v == 0)
+        return false;
+    *val = v;
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    bool user_sizes = false, user_reps = false, complexity = false,
+         suite = false;
+    const char *json = NULL;
+    int c;
+
+    while ((c = getopt(argc, argv, "chj:n:r:s")) != -1) {
+        switch (c) {
+        case 'c':
+            complexity = true;
+            break;
+        case 'j':
+            json = optarg;
+            break;
+        case 's':
+            suite = true;
+            break;
+        case 'n':
+            if (!user_sizes) {
+                n_sizes = 0;
+                user_sizes = true;
+            }
+            if (n_sizes == MAX_SIZES || !parse_size(optarg, &sizes[n_sizes])) {
+                fprintf(stderr, "Invalid or too many sizes '%s'\n", optarg);
+                return 1;
+            }
+            n_sizes++;
+            break;
+        case 'r':
+            reps = atoi(optarg);
+            if (reps < 1) {
+                fprintf(stderr, "Invalid number of repetitions '%s'\n",
+                        optarg);
+                return 1;
+            }
+            user_reps = true;
+            break;
+        default:
+            usage(argv[0]);
+            break;
+        }
+    }
+
+    if (complexity) {
+        if (!user_reps)
+            reps = COMPLEXITY_REPS;
+        return !run_complexity(argv + optind, argc - optind);
+    }
+
+    if (suite) {
+        if (!user_sizes) {
+            n_sizes = sizeof(suite_sizes) / sizeof(suite_sizes[0]);
+            memcpy(sizes, suite_sizes, sizeof(suite_sizes));
+        }
+        if (!user_reps)
+            reps = SUITE_REPS;
+        return !run_suite(argv + optind, argc - optind, json);
+    }
+
+    for (int j = optind; j < argc; j++) {
+        size_t i = 0;
+        while (i < N_BENCHES && strcmp(argv[j], benches[i].name))
+            i++;
+        if (i == N_BENCHES) {
+            fprintf(stderr, "Unknown benchmark '%s'\n", argv[j]);
+            return 1;
+        }
+    }
+
+    bool ok = true;
+    for (size_t i = 0; i < N_BENCHES; i++) {
+        bool selected = optind == argc;
+        for (int j = optind; j < argc && !selected; j++)
+            selected = !strcmp(argv[j], benches[i].name);
+        if (!selected)
+            continue;
+        for (int s = 0; s < n_sizes; s++)
+            ok = benches[i].run(sizes[s]) && ok;
+    }
+
+    return !ok;
+}
@@ -0,0 +1,423 @@
+/* Parallel driver running qtest on the standard traces
+ *
+ * Same traces, scores and report as scripts/driver.py, but traces run in
+ * worker processes at the same time, with their output captured and printed
+ * in trace order. Each trace has a time limit, and a JSON summary can record
+ * the wall time and peak memory of every run.
+ *
+ * Usage: qdriver [-h] [-p PROG] [-t TID] [-v LEVEL] [-j JOBS] [-T SECS]
+ *                [-o FILE] [-A] [-c]
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TRACE_DIR "./traces"
+#define DEFAULT_TIMEOUT 300
+
+#define RED "\033[91m"
+#define GREEN "\033[92m"
+#define WHITE "\033[0m"
+
+typedef struct {
+    int id;
+    const char *name;
+    int max_score;
+    bool exclusive; /* Timing-sensitive, so run with no other trace */
+} trace_t;
+
+static const trace_t traces[] = {
+    {1, "trace-01-ops", 5},
+    {2, "trace-02-ops", 6},
+    {3, "trace-03-ops", 6},
+    {4, "trace-04-ops", 6},
+    {5, "trace-05-ops", 6},
+    {6, "trace-06-ops", 6},
+    {7, "trace-07-string", 6},
+    {8, "trace-08-robust", 6},
+    {9, "trace-09-robust", 6},
+    {10, "trace-10-robust", 6},
+    {11, "trace-11-malloc", 6},
+    {12, "trace-12-malloc", 6},
+    {13, "trace-13-malloc", 6},
+    {14, "trace-14-perf", 6},
+    {15, "trace-15-perf", 6},
+    {16, "trace-16-perf", 6},
+    {17, "trace-17-complexity", 5, true},
+};
+
+#define N_TRACES (sizeof(traces) / sizeof(traces[0]))
+
+typedef enum {
+    RUN_PENDING,
+    RUN_RUNNING,
+    RUN_DONE,
+} run_state_t;
+
+typedef struct {
+    const trace_t *trace;
+    run_state_t state;
+    pid_t pid;
+    FILE *out; /* Captured stdout and stderr */
+    int64_t start_ns, wall_ns;
+    long peak_rss_kb;
+    int status; /* As returned by wait4() */
+    bool timed_out;
+    bool failed_to_start;
+} run_t;
+
+static const char *qtest = "./qtest";
+static int verblevel = 1;
+static bool colored = false;
+static int timeout_secs = DEFAULT_TIMEOUT;
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void print_colored(const char *color, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static void print_colored(const char *color, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    fputs(colored ? color : WHITE, stdout);
+    vprintf(fmt, ap);
+    fputs(WHITE "\n", stdout);
+    va_end(ap);
+}
+
+/* Start qtest on the trace of @r, in a process group of its own so that a
+ * timeout can kill whatever it started as well
+ */
+static void start_run(run_t *r, const sigset_t *child_mask)
+{
+    char fname[256], vname[16];
+    snprintf(fname, sizeof(fname), "%s/%s.cmd", TRACE_DIR, r->trace->name);
+    snprintf(vname, sizeof(vname), "%d", verblevel);
+
+    r->state = RUN_RUNNING;
+    r->start_ns = now_ns();
+    r->out = tmpfile();
+    if (!r->out) {
+        fprintf(stderr, "Cannot capture output of %s: %s\n", r->trace->name,
+                strerror(errno));
+        r->failed_to_start = true;
+        r->state = RUN_DONE;
+        return;
+    }
+
+    fflush(stdout);
+    r->pid = fork();
+    if (r->pid < 0) {
+        fprintf(stderr, "Cannot start %s: %s\n", r->trace->name,
+                strerror(errno));
+        r->failed_to_start = true;
+        r->state = RUN_DONE;
+        return;
+    }
+    if (r->pid == 0) {
+        setpgid(0, 0);
+        sigprocmask(SIG_SETMASK, child_mask, NULL);
+        dup2(fileno(r->out), STDOUT_FILENO);
+        dup2(fileno(r->out), STDERR_FILENO);
+        execl(qtest, qtest, "-v", vname, "-f", fname, (char *) NULL);
+        fprintf(stderr, "Call of '%s -v %s -f %s' failed: %s\n", qtest, vname,
+                fname, strerror(errno));
+        _exit(127);
+    }
+    setpgid(r->pid, r->pid);
+}
+
+/* Collect every worker which exited */
+static int reap(run_t *runs, size_t n)
+{
+    int finished = 0;
+    while (true) {
+        int status;
+        struct rusage ru;
+        pid_t pid = wait4(-1, &status, WNOHANG, &ru);
+        if (pid <= 0)
+            break;
+        for (size_t i = 0; i < n; i++) {
+            run_t *r = &runs[i];
+            if (r->state != RUN_RUNNING || r->pid != pid)
+                continue;
+            r->state = RUN_DONE;
+            r->status = status;
+            r->wall_ns = now_ns() - r->start_ns;
+            r->peak_rss_kb = ru.ru_maxrss;
+            finished++;
+            break;
+        }
+    }
+    return finished;
+}
+
+/* Wait for a worker to exit, at most until the earliest time limit, and kill
+ * the workers past their limit
+ */
+static void wait_workers(run_t *runs, size_t n, const sigset_t *sigchld)
+{
+    int64_t now = now_ns(), limit = INT64_MAX;
+    for (size_t i = 0; i < n; i++) {
+        run_t *r = &runs[i];
+        if (r->state != RUN_RUNNING || r->timed_out)
+            continue;
+        int64_t deadline = r->start_ns + (int64_t) timeout_secs * 1000000000;
+        if (deadline <= now) {
+            r->timed_out = true;
+            kill(-r->pid, SIGKILL);
+        } else if (deadline < limit) {
+            limit = deadline;
+        }
+    }
+
+    struct timespec ts = {.tv_sec = 1}; /* Only killed workers are left */
+    if (limit != INT64_MAX) {
+        ts.tv_sec = (limit - now) / 1000000000;
+        ts.tv_nsec = (limit - now) % 1000000000;
+    }
+    sigtimedwait(sigchld, NULL, &ts);
+}
+
+static bool run_passed(const run_t *r)
+{
+    return !r->failed_to_start && !r->timed_out && WIFEXITED(r->status) &&
+           WEXITSTATUS(r->status) == 0;
+}
+
+static void print_run(const run_t *r)
+{
+    if (verblevel > 0)
+        printf("+++ TESTING trace %s:\n", r->trace->name);
+    if (r->out) {
+        char buf[4096];
+        size_t len;
+        char last = '\n';
+        rewind(r->out);
+        while ((len = fread(buf, 1, sizeof(buf), r->out)) > 0) {
+            fwrite(buf, 1, len, stdout);
+            last = buf[len - 1];
+        }
+        /* A killed worker may stop in the middle of a line */
+        if (last != '\n')
+            putchar('\n');
+    }
+    if (r->timed_out)
+        print_colored(RED, "ERROR: Time limit of %d seconds exceeded",
+                      timeout_secs);
+    else if (WIFSIGNALED(r->status))
+        print_colored(RED, "ERROR: Killed by signal %d", WTERMSIG(r->status));
+
+    int score = run_passed(r) ? r->trace->max_score : 0;
+    print_colored(score < r->trace->max_score ? RED : GREEN, "---\t%s\t%d/%d",
+                  r->trace->name, score, r->trace->max_score);
+    fflush(stdout);
+}
+
+static const char *run_status(const run_t *r)
+{
+    if (r->failed_to_start)
+        return "error";
+    if (r->timed_out)
+        return "timeout";
+    return run_passed(r) ? "pass" : "fail";
+}
+
+static bool write_summary(const char *name,
+                          const run_t *runs,
+                          size_t n,
+                          int64_t wall_ns)
+{
+    FILE *f = fopen(name, "w");
+    if (!f) {
+        fprintf(stderr, "Cannot write %s: %s\n", name, strerror(errno));
+        return false;
+    }
+
+    int score = 0, max_score = 0;
+    fprintf(f, "{\n  \"traces\": [\n");
+    for (size_t i = 0; i < n; i++) {
+        const run_t *r = &runs[i];
+        int s = run_passed(r) ? r->trace->max_score : 0;
+        score += s;
+        max_score += r->trace->max_score;
+        fprintf(f,
+                "    {\"id\": %d, \"name\": \"%s\", \"status\": \"%s\", "
+                "\"score\": %d, \"max_score\": %d, \"wall_ms\": %.3f, "
+                "\"peak_rss_kb\": %ld}%s\n",
+                r->trace->id, r->trace->name, run_status(r), s,
+                r->trace->max_score, r->wall_ns / 1e6, r->peak_rss_kb,
+                i + 1 < n ? "," : "");
+    }
+    fprintf(f,
+            "  ],\n  \"score\": %d,\n  \"max_score\": %d,\n"
+            "  \"wall_ms\": %.3f\n}\n",
+            score, max_score, wall_ns / 1e6);
+    return fclose(f) == 0;
+}
+
+static void usage(const char *name)
+{
+    printf("Usage: %s [-h] [-p PROG] [-t TID] [-v LEVEL] [-j JOBS] [-T SECS] "
+           "[-o FILE] [-A] [-c]\n",
+           name);
+    printf("  -h        Print this message\n");
+    printf("  -p PROG   Program to test (default: %s)\n", qtest);
+    printf("  -t TID    Trace ID to test\n");
+    printf("  -v LEVEL  Set verbosity level (0-3)\n");
+    printf("  -j JOBS   Traces run at once (default: number of CPUs)\n");
+    printf("  -T SECS   Time limit of each trace (default: %d)\n",
+           DEFAULT_TIMEOUT);
+    printf("  -o FILE   Write a JSON summary with wall time and peak memory\n");
+    printf("  -A        Print scores as JSON, as the autograder expects\n");
+    printf("  -c        Enable colored text\n");
+}
+
+int main(int argc, char *argv[])
+{
+    int tid = 0, jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    const char *summary_name = NULL;
+    bool autograde = false, level_fixed = false;
+
+    int c;
+    while ((c = getopt(argc, argv, "hp:t:v:j:T:o:Ac")) != -1) {
+        switch (c) {
+        case 'h':
+            usage(argv[0]);
+            return 0;
+        case 'p':
+            qtest = optarg;
+            break;
+        case 't':
+            tid = atoi(optarg);
+            break;
+        case 'v':
+            verblevel = atoi(optarg);
+            level_fixed = true;
+            break;
+        case 'j':
+            jobs = atoi(optarg);
+            break;
+        case 'T':
+            timeout_secs = atoi(optarg);
+            break;
+        case 'o':
+            summary_name = optarg;
+            break;
+        case 'A':
+            autograde = true;
+            break;
+        case 'c':
+            colored = true;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (!level_fixed && autograde)
+        verblevel = 0;
+    if (jobs < 1)
+        jobs = 1;
+    if (timeout_secs < 1) {
+        fprintf(stderr, "Invalid time limit %d\n", timeout_secs);
+        return 1;
+    }
+
+    run_t runs[N_TRACES];
+    size_t n = 0;
+    for (size_t i = 0; i < N_TRACES; i++) {
+        if (tid && traces[i].id != tid)
+            continue;
+        runs[n++] = (run_t){.trace = &traces[i], .state = RUN_PENDING};
+    }
+    if (!n) {
+        print_colored(RED, "ERROR: Invalid trace ID %d", tid);
+        return 1;
+    }
+
+    /* SIGCHLD stays pending until sigtimedwait() takes it, so no exit is
+     * missed between reaping and waiting
+     */
+    sigset_t sigchld, old_mask;
+    sigemptyset(&sigchld);
+    sigaddset(&sigchld, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &sigchld, &old_mask);
+
+    printf("---\tTrace\t\tPoints\n");
+    int64_t start = now_ns();
+    size_t done = 0, printed = 0;
+    int running = 0;
+    bool exclusive_running = false;
+    while (printed < n) {
+        /* Exclusive traces wait for the others to finish, then run alone */
+        for (size_t i = 0; i < n && running < jobs && !exclusive_running;
+             i++) {
+            run_t *r = &runs[i];
+            if (r->state != RUN_PENDING)
+                continue;
+            if (r->trace->exclusive && running)
+                break;
+            start_run(r, &old_mask);
+            if (r->state == RUN_DONE) {
+                done++;
+                continue;
+            }
+            running++;
+            exclusive_running = r->trace->exclusive;
+        }
+
+        while (printed < n && runs[printed].state == RUN_DONE)
+            print_run(&runs[printed++]);
+        if (done == n)
+            continue;
+
+        wait_workers(runs, n, &sigchld);
+        int finished = reap(runs, n);
+        done += finished;
+        running -= finished;
+        if (!running)
+            exclusive_running = false;
+    }
+    int64_t wall_ns = now_ns() - start;
+
+    int score = 0, max_score = 0;
+    for (size_t i = 0; i < n; i++) {
+        score += run_passed(&runs[i]) ? runs[i].trace->max_score : 0;
+        max_score += runs[i].trace->max_score;
+        if (runs[i].out)
+            fclose(runs[i].out);
+    }
+    print_colored(score < max_score ? RED : GREEN, "---\tTOTAL\t\t%d/%d",
+                  score, max_score);
+
+    if (autograde) {
+        printf("{\"scores\": {");
+        for (size_t i = 0; i < n; i++)
+            printf("%s\"Trace-%02d\" : %d", i ? ", " : "", runs[i].trace->id,
+                   run_passed(&runs[i]) ? runs[i].trace->max_score : 0);
+        printf("}}\n");
+    }
+
+    if (summary_name && !write_summary(summary_name, runs, n, wall_ns))
+        return 1;
+    return score < max_score;
+}